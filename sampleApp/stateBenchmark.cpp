@@ -0,0 +1,1040 @@
+/* -*- Mode:C++; c-file-style:"bsd"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright 2020 Washington University in St. Louis
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <../src/ibft.hpp>
+#include <../src/hash-policy.hpp>
+#include <../src/notification-log.hpp>
+#include <../src/pin-sketch.hpp>
+#include <../src/state.hpp>
+#include <../src/state-codec.hpp>
+#include <../src/state-file.hpp>
+
+// global variable to support debug
+int DEBUG = 0;
+
+// heap allocations so far, counted for -t push
+static std::atomic<size_t> g_allocations(0);
+
+void*
+operator new(size_t size)
+{
+  g_allocations++;
+  void* p = std::malloc(size);
+  if (p == nullptr)
+    throw std::bad_alloc();
+  return p;
+}
+
+void
+operator delete(void* p) noexcept
+{
+  std::free(p);
+}
+
+namespace ndn {
+  class StateBenchmark
+  {
+  public:
+
+    StateBenchmark(char* programName)
+    : m_programName(programName)
+    , m_iterations(0)
+    , m_memory(50)
+    , m_producers(4)
+    {
+    }
+
+    void
+    usage()
+    {
+      std::cout << "\n Usage:\n " << m_programName <<
+      ""
+      " [-h] -t test [-n iterations] [-m maxMemorySize] [-p producers] [-d debug_mode]\n"
+      " Measure the cost of notification state operations on this host.\n"
+      "\n"
+      " \t-h - print this message and exit\n"
+      " \t-t - test to run: hash, codec, state, push, snapshot, sketch, or\n"
+      " \t     check (no timing: checks sketch decoding, snapshot files and\n"
+      " \t     the notification log, exits with 1 if any check fails)\n"
+      " \t-n - number of keys (hash, default 1000000), calls (codec, state,\n"
+      " \t     push and snapshot, default 2000) or decodes (sketch, default\n"
+      " \t     50) per measurement\n"
+      " \t-m - maxMemorySize of the states built for codec, state, push,\n"
+      " \t     snapshot and sketch (default 50)\n"
+      " \t-p - number of producers for state (default 4)\n"
+      " \t-d - sets the debug mode, 1 - debug on, 0 - debug off (default)\n"
+      "\n";
+      exit(1);
+    }
+
+    void
+    setIterations(int iterations)
+    {
+      m_iterations = iterations;
+    }
+
+    void
+    setMemory(size_t memory)
+    {
+      m_memory = memory;
+    }
+
+    void
+    setProducers(int producers)
+    {
+      m_producers = producers;
+    }
+
+    // Times every IBF hash type, both the raw hash and a full insert+erase
+    // in a small IBF, and reports the hashType with the cheapest hash
+    // (the rest of an IBF update is the same for all of them)
+    void
+    runHash()
+    {
+      const int types[] = {notificationLib::HashType::MURMUR3,
+                           notificationLib::HashType::MURMUR3_DOUBLE,
+                           notificationLib::HashType::XXH3,
+                           notificationLib::HashType::WYHASH};
+      const char* names[] = {"MURMUR3", "MURMUR3_DOUBLE", "XXH3", "WYHASH"};
+
+      std::cout << std::left << std::setw(16) << "hashType"
+                << std::setw(14) << "hash ns/key"
+                << "ibf ns/key" << std::endl;
+
+      int fastest = 0;
+      double fastestTime = 0;
+      double hashTimes[4], ibfTimes[4];
+      for (int t = 0; t < 4; t++)
+      {
+        double hashTime = timeHash(types[t]);
+        double ibfTime = timeIbf(types[t]);
+        hashTimes[t] = hashTime;
+        ibfTimes[t] = ibfTime;
+        std::cout << std::left << std::setw(16) << names[t]
+                  << std::setw(14) << std::fixed << std::setprecision(2) << hashTime
+                  << ibfTime << std::endl;
+        if (t == 0 || hashTime < fastestTime)
+        {
+          fastest = t;
+          fastestTime = hashTime;
+        }
+      }
+      std::cout << "fastest: hashType " << names[fastest] << std::endl;
+      // one 64-bit hash against the five 32-bit passes of the default
+      std::cout << "MURMUR3_DOUBLE speedup over MURMUR3: "
+                << std::setprecision(1) << hashTimes[0] / hashTimes[1] << "x per key hash, "
+                << ibfTimes[0] / ibfTimes[1] << "x per IBF update" << std::endl;
+    }
+
+    // Compares the state codecs on an IBF state and on a LIST state in
+    // both encodings: encoded size, ratio and microseconds per call
+    void
+    runCodec()
+    {
+      std::cout << std::left << std::setw(12) << "state"
+                << std::setw(10) << "codec"
+                << std::setw(10) << "raw"
+                << std::setw(10) << "bytes"
+                << std::setw(8) << "ratio"
+                << std::setw(14) << "compress us"
+                << "decompress us" << std::endl;
+
+      timeCodecs("IBF", buildRawState(notificationLib::StateType::IBF,
+                                      notificationLib::ListEncoding::TLV));
+      timeCodecs("LIST/TLV", buildRawState(notificationLib::StateType::LIST,
+                                           notificationLib::ListEncoding::TLV));
+      timeCodecs("LIST/DELTA", buildRawState(notificationLib::StateType::LIST,
+                                             notificationLib::ListEncoding::DELTA));
+    }
+
+    // Compares the state types on a group of producers that stay in
+    // sync: uncompressed state size and the cost of decoding and
+    // diffing the state of a peer that missed the last notification of
+    // every producer
+    void
+    runState()
+    {
+      std::cout << std::left << std::setw(16) << "state"
+                << std::setw(10) << "bytes"
+                << std::setw(12) << "diff us"
+                << "inLocal/inRemote" << std::endl;
+
+      const int types[] = {notificationLib::StateType::IBF,
+                           notificationLib::StateType::IBF,
+                           notificationLib::StateType::LIST,
+                           notificationLib::StateType::LIST,
+                           notificationLib::StateType::LIST,
+                           notificationLib::StateType::TUPLE,
+                           notificationLib::StateType::BLOOM,
+                           notificationLib::StateType::RANGE,
+                           notificationLib::StateType::SKETCH};
+      const int encodings[] = {notificationLib::ListEncoding::TLV,
+                               notificationLib::ListEncoding::TLV,
+                               notificationLib::ListEncoding::TLV,
+                               notificationLib::ListEncoding::TLV,
+                               notificationLib::ListEncoding::WATERMARK,
+                               notificationLib::ListEncoding::TLV,
+                               notificationLib::ListEncoding::TLV,
+                               notificationLib::ListEncoding::TLV,
+                               notificationLib::ListEncoding::TLV};
+      // relative keys in microseconds
+      const uint64_t keyResolutions[] = {0, 1000, 0, 1000, 0, 0, 0, 0, 0};
+      const char* names[] = {"IBF", "IBF/RELATIVE", "LIST", "LIST/RELATIVE",
+                             "LIST/WATERMARK", "TUPLE", "BLOOM", "RANGE", "SKETCH"};
+      for (int t = 0; t < 9; t++)
+        timeState(names[t], types[t], encodings[t], keyResolutions[t]);
+    }
+
+    // Compares building the content pushed for a diff by copying the
+    // event lists into a NotificationData with encoding it straight
+    // from the history: microseconds and heap allocations per pushed
+    // notification
+    void
+    runPush()
+    {
+      notificationLib::State state(m_memory, notificationLib::StateType::IBF);
+      std::vector<Name> events{Name("/benchmark/event/a"), Name("/benchmark/event/b"),
+                               Name("/benchmark/event/c")};
+      std::vector<uint64_t> timestamps;
+      for (size_t i = 0; i < m_memory; i++)
+      {
+        timestamps.push_back(state.createKey(events));
+        std::this_thread::sleep_for(std::chrono::microseconds(20));
+      }
+
+      size_t copySize = 0;
+      size_t allocations = g_allocations;
+      auto start = std::chrono::steady_clock::now();
+      for (int i = 0; i < iterations(2000); i++)
+      {
+        std::unordered_map<uint64_t,std::vector<Name>> listToPush;
+        for (auto timestamp: timestamps)
+          listToPush[timestamp] = state.getEventsAtTimestamp(timestamp);
+        notificationLib::NotificationData data(listToPush);
+        copySize = data.wireEncode().size();
+      }
+      auto copyTime = std::chrono::steady_clock::now() - start;
+      size_t copyAllocations = g_allocations - allocations;
+
+      size_t viewSize = 0;
+      allocations = g_allocations;
+      start = std::chrono::steady_clock::now();
+      for (int i = 0; i < iterations(2000); i++)
+        viewSize = state.encodeEvents(timestamps).size();
+      auto viewTime = std::chrono::steady_clock::now() - start;
+      size_t viewAllocations = g_allocations - allocations;
+
+      double pushes = static_cast<double>(iterations(2000)) * timestamps.size();
+      std::cout << std::left << std::setw(8) << "path"
+                << std::setw(10) << "bytes"
+                << std::setw(16) << "us/notification"
+                << "allocations/notification" << std::endl;
+      std::cout << std::left << std::setw(8) << "copy"
+                << std::setw(10) << copySize
+                << std::setw(16) << std::fixed << std::setprecision(3)
+                << std::chrono::duration<double, std::micro>(copyTime).count() / pushes
+                << copyAllocations / pushes << std::endl;
+      std::cout << std::left << std::setw(8) << "view"
+                << std::setw(10) << viewSize
+                << std::setw(16) << std::fixed << std::setprecision(3)
+                << std::chrono::duration<double, std::micro>(viewTime).count() / pushes
+                << viewAllocations / pushes << std::endl;
+    }
+
+    // Notifications on the io thread, each followed by the encoding of
+    // the state and a diff against a stale peer: done inline, then on
+    // a worker thread from published snapshots. Reports the io thread
+    // time per notification and how many snapshots the worker got to.
+    void
+    runSnapshot()
+    {
+      std::cout << std::left << std::setw(10) << "path"
+                << std::setw(16) << "io us/notify"
+                << "encoded+diffed" << std::endl;
+      timeSnapshot(false);
+      timeSnapshot(true);
+    }
+
+    // Compares the SKETCH state with an IBF, both sized for the
+    // difference, between peers that share maxMemorySize notifications
+    // and differ by 1 to 100: bytes before compression, microseconds to
+    // subtract and decode (the sketch with and without the carry-less
+    // multiply instruction) and how many decodes listed it all
+    void
+    runSketch()
+    {
+      std::cout << "carry-less multiply: "
+                << (notificationLib::PinSketch::isClmulEnabled() ? "yes" : "no") << std::endl;
+      std::cout << std::left << std::setw(6) << "diff"
+                << std::setw(11) << "ibf bytes"
+                << std::setw(10) << "ibf us"
+                << std::setw(8) << "ibf ok"
+                << std::setw(14) << "sketch bytes"
+                << std::setw(11) << "clmul us"
+                << std::setw(14) << "portable us"
+                << "sketch ok" << std::endl;
+      const size_t diffs[] = {1, 2, 5, 10, 20, 50, 100};
+      for (auto diff: diffs)
+        timeSketch(diff);
+    }
+
+    // Self-checks of the code the timings above do not verify: sketch
+    // decodes with and without the carry-less multiply, RANGE rounds,
+    // state files and the notification log written and read back.
+    // Returns false if any check failed.
+    bool
+    runCheck()
+    {
+      bool ok = true;
+      ok = checkSketch() && ok;
+      ok = checkRanges() && ok;
+      ok = checkStateFile() && ok;
+      ok = checkLog() && ok;
+      std::cout << (ok ? "all checks passed" : "CHECKS FAILED") << std::endl;
+      return ok;
+    }
+
+  private:
+    bool
+    report(const std::string& check, bool ok)
+    {
+      std::cout << std::left << std::setw(52) << check << (ok ? "ok" : "FAILED") << std::endl;
+      return ok;
+    }
+
+    // a scratch directory for the file checks
+    std::string
+    makeScratchDirectory()
+    {
+      char path[] = "/tmp/stateBenchmark.XXXXXX";
+      return mkdtemp(path) != nullptr ? path : "";
+    }
+
+    // Sets of 0 to 3x the capacity keys: up to the capacity they must
+    // decode to the keys, above it decoding must fail (the State checks
+    // with a spare power sum), and both multiplies must agree
+    bool
+    checkSketch()
+    {
+      bool hasClmul = notificationLib::PinSketch::isClmulEnabled();
+      std::mt19937_64 random(48);
+      bool ok = true;
+      const size_t capacities[] = {1, 4, 16, 50};
+      for (auto capacity: capacities)
+      {
+        const size_t diffs[] = {0, 1, capacity / 2, capacity, capacity + 1, capacity + 5,
+                                3 * capacity};
+        bool decodesOk = true, agree = true, wireOk = true;
+        for (auto diff: diffs)
+        {
+          for (int trial = 0; trial < 20; trial++)
+          {
+            // half the keys on each side of the merge
+            notificationLib::PinSketch local(capacity + 1), remote(capacity + 1);
+            std::vector<uint64_t> keys;
+            while (keys.size() < diff)
+            {
+              uint64_t key = random();
+              if (key == 0 || std::find(keys.begin(), keys.end(), key) != keys.end())
+                continue;
+              keys.push_back(key);
+              (keys.size() % 2 == 0 ? local : remote).add(key);
+            }
+            std::sort(keys.begin(), keys.end());
+            local.merge(remote);
+
+            notificationLib::PinSketch restored;
+            Block wire = local.wireEncode();
+            Block restoredWire = restored.wireDecode(wire) ? restored.wireEncode() : Block();
+            if (restoredWire.size() != wire.size() ||
+                !std::equal(wire.wire(), wire.wire() + wire.size(), restoredWire.wire()))
+              wireOk = false;
+
+            std::vector<uint64_t> results[2];
+            bool decoded[2] = {false, false};
+            for (int clmul = 0; clmul < (hasClmul ? 2 : 1); clmul++)
+            {
+              notificationLib::PinSketch::setClmulEnabled(clmul);
+              decoded[clmul] = local.decode(results[clmul], capacity);
+              std::sort(results[clmul].begin(), results[clmul].end());
+            }
+            notificationLib::PinSketch::setClmulEnabled(hasClmul);
+
+            if (hasClmul && (decoded[0] != decoded[1] || results[0] != results[1]))
+              agree = false;
+            if (diff <= capacity ? !decoded[0] || results[0] != keys : decoded[0])
+              decodesOk = false;
+          }
+        }
+        std::string name = "sketch capacity " + std::to_string(capacity);
+        ok = report(name + ": decodes, fails above capacity", decodesOk) && ok;
+        ok = report(name + ": wire round trip", wireOk) && ok;
+        if (hasClmul)
+          ok = report(name + ": clmul and portable agree", agree) && ok;
+      }
+      if (!hasClmul)
+        std::cout << "no carry-less multiply on this host, portable decode only" << std::endl;
+      return ok;
+    }
+
+    // A RANGE consumer that missed some of 5000 notifications, and may
+    // hold some the producer lacks, catches up in rounds: the state,
+    // then only the split ranges that still differ. It must end up with
+    // everything, having been pushed at most rangeLeafSize notifications
+    // per one that differs, within log16 rounds.
+    bool
+    checkRanges()
+    {
+      const size_t total = 5000;
+      ndn::time::milliseconds freshness(3600000);
+      auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::system_clock::now().time_since_epoch()).count();
+      std::mt19937_64 random(47);
+      bool ok = true;
+      const size_t missed[] = {1, 5, 50};
+      for (auto missing: missed)
+      {
+        for (size_t extra: {size_t(0), size_t(3)})
+        {
+          notificationLib::StateOptions options;
+          notificationLib::State producer(total, notificationLib::StateType::RANGE, options);
+          notificationLib::State consumer(total, notificationLib::StateType::RANGE, options);
+          std::vector<uint64_t> timestamps;
+          for (size_t i = 0; i < total; i++)
+          {
+            timestamps.push_back(now - (total - i) * 100000);
+            producer.addLocal(timestamps.back(), {Name("/check/event").appendNumber(i)});
+          }
+          std::vector<uint64_t> lost(timestamps);
+          std::shuffle(lost.begin(), lost.end(), random);
+          lost.resize(missing);
+          std::sort(lost.begin(), lost.end());
+          for (auto timestamp: timestamps)
+          {
+            if (!std::binary_search(lost.begin(), lost.end(), timestamp))
+              consumer.addLocal(timestamp, producer.getEventsAtTimestamp(timestamp));
+          }
+          for (size_t i = 0; i < extra; i++)
+            consumer.addLocal(timestamps[i * 1000] + 1, {Name("/check/extra")});
+
+          size_t pushed = 0;
+          int rounds = 0;
+          ConstBufferPtr request = consumer.getState();
+          bool decoded = true;
+          while (request != nullptr && rounds < 10)
+          {
+            rounds++;
+            std::set<std::pair<uint64_t,std::vector<uint8_t>>> inLocal, inRemote;
+            Block subRanges;
+            auto snapshot = producer.snapshot();
+            decoded = snapshot->getDiff(request, inLocal, inRemote, subRanges) && decoded;
+            std::vector<uint64_t> listToPush;
+            for (auto const& entry: inLocal)
+              listToPush.push_back(entry.first);
+            pushed += listToPush.size();
+            notificationLib::NotificationData data;
+            data.wireDecode(snapshot->encodeEvents(listToPush, subRanges));
+            consumer.reconcile(producer.getState(), data, freshness);
+            const Block& ranges = data.m_eventsObj.getRanges();
+            request = ranges.hasWire() ? consumer.getRangeRequest(ranges) : nullptr;
+          }
+
+          bool complete = true;
+          for (auto timestamp: timestamps)
+            complete = complete && !consumer.getEventsAtTimestamp(timestamp).empty();
+          std::string name = "range " + std::to_string(missing) + " missed, " +
+                             std::to_string(extra) + " extra";
+          ok = report(name + ": complete", decoded && complete) && ok;
+          ok = report(name + ": " + std::to_string(pushed) + " pushed in " +
+                      std::to_string(rounds) + " rounds",
+                      pushed <= (missing + extra) * options.rangeLeafSize && rounds <= 4) && ok;
+        }
+      }
+      return ok;
+    }
+
+    // Every state type saved to a file and restored into a new state
+    // encodes the same; damaged, truncated or foreign files restore
+    // nothing
+    bool
+    checkStateFile()
+    {
+      std::string directory = makeScratchDirectory();
+      if (directory.empty())
+        return report("state file: scratch directory", false);
+      const int types[] = {notificationLib::StateType::IBF,
+                           notificationLib::StateType::LIST,
+                           notificationLib::StateType::TUPLE,
+                           notificationLib::StateType::BLOOM,
+                           notificationLib::StateType::RANGE,
+                           notificationLib::StateType::SKETCH};
+      const char* names[] = {"IBF", "LIST", "TUPLE", "BLOOM", "RANGE", "SKETCH"};
+      ndn::time::milliseconds freshness(3600000);
+      bool ok = true;
+      for (int t = 0; t < 6; t++)
+      {
+        notificationLib::State state(m_memory, types[t]);
+        std::vector<uint64_t> timestamps;
+        for (size_t i = 0; i < m_memory; i++)
+          timestamps.push_back(state.createKey({Name("/check/event").appendNumber(i % 7),
+                                                Name("/check/other")}));
+        std::string path = directory + "/" + names[t] + ".state";
+        bool written = notificationLib::StateFile::write(path, *state.saveImage());
+
+        notificationLib::State restored(m_memory, types[t]);
+        bool same = written && restored.restore(path, freshness) == timestamps.size() &&
+                    *restored.getState() == *state.getState();
+        for (auto timestamp: timestamps)
+          same = same && restored.getEventsAtTimestamp(timestamp) ==
+                         state.getEventsAtTimestamp(timestamp);
+        ok = report(std::string("state file ") + names[t] + ": round trip", same) && ok;
+
+        int otherType = types[(t + 1) % 6];
+        notificationLib::State foreign(m_memory, otherType);
+        ok = report(std::string("state file ") + names[t] + ": other type rejected",
+                    foreign.restore(path, freshness) == 0) && ok;
+
+        // one byte flipped in the middle, then the file cut short
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekg(0, std::ios::end);
+        std::streamoff size = file.tellg();
+        file.seekg(size / 2);
+        char byte = file.get();
+        file.seekp(size / 2);
+        file.put(byte ^ 0x5a);
+        file.close();
+        notificationLib::State damaged(m_memory, types[t]);
+        bool rejected = damaged.restore(path, freshness) == 0;
+        notificationLib::StateFile::write(path, *state.saveImage());
+        rejected = rejected && truncate(path.c_str(), size - 8) == 0;
+        notificationLib::State truncated(m_memory, types[t]);
+        rejected = rejected && truncated.restore(path, freshness) == 0;
+        ok = report(std::string("state file ") + names[t] + ": damage rejected", rejected) && ok;
+        unlink(path.c_str());
+      }
+      rmdir(directory.c_str());
+      return ok;
+    }
+
+    // Records committed in batches replay in order; with the last record
+    // cut short the others still replay, and the next commit (to a new
+    // segment) replays after them
+    bool
+    checkLog()
+    {
+      typedef std::vector<std::pair<uint64_t, std::vector<Name>>> Records;
+      std::string directory = makeScratchDirectory();
+      if (directory.empty())
+        return report("log: scratch directory", false);
+      const uint64_t hour = 3600000000000ULL;
+      auto replay = [&directory, hour] {
+        Records records;
+        notificationLib::NotificationLog log(directory, hour);
+        log.replay([&records] (uint64_t timestamp, const std::vector<Name>& eventList) {
+          records.push_back(std::make_pair(timestamp, eventList));
+        });
+        return records;
+      };
+
+      Records records;
+      bool committed = true;
+      {
+        notificationLib::NotificationLog log(directory, hour);
+        std::vector<uint8_t> batch;
+        for (size_t i = 0; i < 1000; i++)
+        {
+          std::vector<Name> eventList{Name("/check/event").appendNumber(i)};
+          if (i % 3 == 0)
+            eventList.push_back(Name("/check/other"));
+          records.push_back(std::make_pair(keyAt(i), eventList));
+          notificationLib::NotificationLog::encode(batch, keyAt(i), eventList);
+          if (i % 64 == 63)
+          {
+            committed = log.commit(batch) && committed;
+            batch.clear();
+          }
+        }
+        committed = log.commit(batch) && committed;
+      }
+      bool ok = report("log: batches replay in order", committed && replay() == records);
+
+      // the only segment, cut in the middle of its last record
+      std::string segment;
+      DIR* dir = opendir(directory.c_str());
+      while (struct dirent* entry = readdir(dir))
+        if (entry->d_name[0] != '.')
+          segment = directory + "/" + entry->d_name;
+      closedir(dir);
+      struct stat status;
+      bool cut = !segment.empty() && stat(segment.c_str(), &status) == 0 &&
+                 truncate(segment.c_str(), status.st_size - 5) == 0;
+      records.pop_back();
+      ok = report("log: torn last record dropped", cut && replay() == records) && ok;
+
+      {
+        notificationLib::NotificationLog log(directory, hour);
+        std::vector<uint8_t> batch;
+        std::vector<Name> eventList{Name("/check/after")};
+        records.push_back(std::make_pair(keyAt(2000), eventList));
+        notificationLib::NotificationLog::encode(batch, keyAt(2000), eventList);
+        committed = log.commit(batch);
+      }
+      ok = report("log: commit after a torn record replays", committed && replay() == records) && ok;
+
+      // a byte flipped in the 11th record of the first segment: its
+      // checksum ends the replay of that segment, not of the next
+      std::vector<uint8_t> head;
+      for (size_t i = 0; i < 10; i++)
+        notificationLib::NotificationLog::encode(head, records[i].first, records[i].second);
+      std::string first;
+      dir = opendir(directory.c_str());
+      while (struct dirent* entry = readdir(dir))
+        if (entry->d_name[0] != '.' && (first.empty() || directory + "/" + entry->d_name < first))
+          first = directory + "/" + entry->d_name;
+      closedir(dir);
+      std::fstream file(first, std::ios::in | std::ios::out | std::ios::binary);
+      file.seekg(head.size() + 24);
+      char byte = file.get();
+      file.seekp(head.size() + 24);
+      file.put(byte ^ 0x5a);
+      file.close();
+      Records expected(records.begin(), records.begin() + 10);
+      expected.push_back(records.back());
+      ok = report("log: damaged record ends its segment", replay() == expected) && ok;
+
+      dir = opendir(directory.c_str());
+      while (struct dirent* entry = readdir(dir))
+        if (entry->d_name[0] != '.')
+          unlink((directory + "/" + entry->d_name).c_str());
+      closedir(dir);
+      rmdir(directory.c_str());
+      return ok;
+    }
+
+    void
+    timeSketch(size_t diff)
+    {
+      bool hasClmul = notificationLib::PinSketch::isClmulEnabled();
+      int trials = iterations(50);
+      size_t ibfBytes = 0, sketchBytes = 0;
+      int ibfDecoded = 0, sketchDecoded = 0;
+      std::chrono::steady_clock::duration ibfTime{}, clmulTime{}, portableTime{};
+      for (int trial = 0; trial < trials; trial++)
+      {
+        // the SKETCH state keeps a spare power sum to check the result
+        notificationLib::IBFT localIbf(diff, 4), remoteIbf(diff, 4);
+        notificationLib::PinSketch localSketch(diff + 1), remoteSketch(diff + 1);
+        std::vector<uint8_t> value(4);
+        for (size_t i = 0; i < m_memory + diff; i++)
+        {
+          // the first maxMemorySize are shared, the rest alternate sides
+          uint64_t key = keyAt(trial * (m_memory + diff) + i);
+          bool local = i < m_memory || i % 2 == 0;
+          bool remote = i < m_memory || i % 2 == 1;
+          std::memcpy(value.data(), &key, 4);
+          if (local)
+          {
+            localIbf.insert(key, value);
+            localSketch.add(key);
+          }
+          if (remote)
+          {
+            remoteIbf.insert(key, value);
+            remoteSketch.add(key);
+          }
+        }
+        ibfBytes = localIbf.wireEncode().size();
+        sketchBytes = localSketch.wireEncode().size();
+
+        auto start = std::chrono::steady_clock::now();
+        std::set<std::pair<uint64_t,std::vector<uint8_t> > > positive, negative;
+        bool listed = (localIbf - remoteIbf).listEntries(positive, negative);
+        ibfTime += std::chrono::steady_clock::now() - start;
+        if (listed && positive.size() + negative.size() == diff)
+          ibfDecoded++;
+
+        for (int clmul = 1; clmul >= 0; clmul--)
+        {
+          notificationLib::PinSketch::setClmulEnabled(clmul);
+          start = std::chrono::steady_clock::now();
+          notificationLib::PinSketch merged(localSketch);
+          merged.merge(remoteSketch);
+          std::vector<uint64_t> elements;
+          bool decoded = merged.decode(elements, diff);
+          (clmul ? clmulTime : portableTime) += std::chrono::steady_clock::now() - start;
+          if (clmul && decoded && elements.size() == diff)
+            sketchDecoded++;
+        }
+        notificationLib::PinSketch::setClmulEnabled(hasClmul);
+      }
+
+      std::cout << std::left << std::setw(6) << diff
+                << std::setw(11) << ibfBytes
+                << std::setw(10) << std::fixed << std::setprecision(1)
+                << std::chrono::duration<double, std::micro>(ibfTime).count() / trials
+                << std::setw(8) << std::to_string(ibfDecoded) + "/" + std::to_string(trials)
+                << std::setw(14) << sketchBytes
+                << std::setw(11)
+                << std::chrono::duration<double, std::micro>(clmulTime).count() / trials
+                << std::setw(14)
+                << std::chrono::duration<double, std::micro>(portableTime).count() / trials
+                << sketchDecoded << "/" << trials << std::endl;
+    }
+
+    void
+    timeSnapshot(bool offload)
+    {
+      notificationLib::State state(m_memory, notificationLib::StateType::IBF);
+      std::vector<Name> events{Name("/benchmark/event/a")};
+      std::deque<uint64_t> live;
+      for (size_t i = 0; i < m_memory; i++)
+        live.push_back(state.createKey(events));
+      ConstBufferPtr stale = state.getState();
+
+      std::mutex mutex;
+      std::shared_ptr<const notificationLib::StateSnapshot> published;
+      std::atomic<bool> done(false);
+      std::atomic<int> processed(0);
+      std::thread worker;
+      if (offload)
+      {
+        worker = std::thread([&] {
+          uint64_t lastVersion = 0;
+          while (!done)
+          {
+            std::shared_ptr<const notificationLib::StateSnapshot> snapshot;
+            {
+              std::lock_guard<std::mutex> lock(mutex);
+              snapshot = published;
+            }
+            if (snapshot == nullptr || snapshot->getVersion() == lastVersion)
+            {
+              std::this_thread::yield();
+              continue;
+            }
+            std::set<std::pair<uint64_t,std::vector<uint8_t> > > inLocal, inRemote;
+            snapshot->getState();
+            snapshot->getDiff(stale, inLocal, inRemote);
+            lastVersion = snapshot->getVersion();
+            processed++;
+          }
+        });
+      }
+
+      auto start = std::chrono::steady_clock::now();
+      for (int i = 0; i < iterations(2000); i++)
+      {
+        live.push_back(state.createKey(events));
+        state.erase(live.front());
+        live.pop_front();
+        if (offload)
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          published = state.snapshot();
+        }
+        else
+        {
+          std::set<std::pair<uint64_t,std::vector<uint8_t> > > inLocal, inRemote;
+          state.getState();
+          state.getDiff(stale, inLocal, inRemote);
+          processed++;
+        }
+      }
+      auto elapsed = std::chrono::steady_clock::now() - start;
+      done = true;
+      if (worker.joinable())
+        worker.join();
+
+      std::cout << std::left << std::setw(10) << (offload ? "snapshot" : "inline")
+                << std::setw(16) << std::fixed << std::setprecision(2)
+                << std::chrono::duration<double, std::micro>(elapsed).count() / iterations(2000)
+                << processed << "/" << iterations(2000) << std::endl;
+    }
+
+    // timestamps as produced by State::createKey, about 1us apart
+    uint64_t
+    keyAt(int i) const
+    {
+      return 1600000000000000000ULL + static_cast<uint64_t>(i) * 1013;
+    }
+
+    double
+    timeHash(int type)
+    {
+      uint64_t acc = 0;
+      auto start = std::chrono::steady_clock::now();
+      for (int i = 0; i < iterations(1000000); i++)
+      {
+        uint64_t k = keyAt(i);
+        switch (type)
+        {
+          case notificationLib::HashType::MURMUR3:
+            for (uint32_t seed = 0; seed < 4; seed++)
+              acc += MurmurHash3(seed, k);
+            acc ^= MurmurHash3(11, k);
+            break;
+          case notificationLib::HashType::MURMUR3_DOUBLE:
+            acc += notificationLib::Murmur3Hash::hash64(11, k);
+            break;
+          case notificationLib::HashType::XXH3:
+            acc += notificationLib::Xxh3Hash::hash64(11, k);
+            break;
+          case notificationLib::HashType::WYHASH:
+            acc += notificationLib::WyHash::hash64(11, k);
+            break;
+        }
+      }
+      auto elapsed = std::chrono::steady_clock::now() - start;
+      if (DEBUG)
+        std::cout << "checksum " << acc << std::endl;
+      return std::chrono::duration<double, std::nano>(elapsed).count() / iterations(1000000);
+    }
+
+    double
+    timeIbf(int type)
+    {
+      notificationLib::IBFT ibf(50, 8, type);
+      std::vector<uint8_t> value(8);
+      auto start = std::chrono::steady_clock::now();
+      for (int i = 0; i < iterations(1000000); i++)
+      {
+        ibf.insert(keyAt(i), value);
+        ibf.erase(keyAt(i), value);
+      }
+      auto elapsed = std::chrono::steady_clock::now() - start;
+      return std::chrono::duration<double, std::nano>(elapsed).count() / (2.0 * iterations(1000000));
+    }
+
+    int
+    iterations(int defaultIterations) const
+    {
+      return m_iterations > 0 ? m_iterations : defaultIterations;
+    }
+
+    // Fills a state of the given type with maxMemorySize notifications
+    // about half a millisecond apart and returns its encoding before
+    // compression
+    notificationLib::ConstBufferPtr
+    buildRawState(int stateType, int listEncoding)
+    {
+      notificationLib::StateOptions options;
+      options.listEncoding = listEncoding;
+      options.codec = notificationLib::CodecType::NONE;
+      notificationLib::State state(m_memory, stateType, options);
+      std::vector<Name> events{Name("/benchmark/event")};
+      for (size_t i = 0; i < m_memory; i++)
+      {
+        state.createKey(events);
+        std::this_thread::sleep_for(std::chrono::microseconds(500));
+      }
+      auto encoded = state.getState();
+      return notificationLib::StateCodec::decompress(encoded->data(), encoded->size());
+    }
+
+    void
+    timeCodecs(const std::string& stateName, notificationLib::ConstBufferPtr raw)
+    {
+      const int codecs[] = {notificationLib::CodecType::BZIP2,
+                            notificationLib::CodecType::NONE,
+                            notificationLib::CodecType::LZ4,
+                            notificationLib::CodecType::ZSTD,
+                            notificationLib::CodecType::DEFLATE};
+      const char* names[] = {"BZIP2", "NONE", "LZ4", "ZSTD", "DEFLATE"};
+
+      for (int c = 0; c < 5; c++)
+      {
+        if (!notificationLib::StateCodec::isSupported(codecs[c]))
+        {
+          std::cout << std::left << std::setw(12) << stateName
+                    << std::setw(10) << names[c] << "not in this build" << std::endl;
+          continue;
+        }
+
+        notificationLib::ConstBufferPtr compressed;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations(2000); i++)
+          compressed = notificationLib::StateCodec::compress(codecs[c], raw->data(), raw->size());
+        auto compressTime = std::chrono::steady_clock::now() - start;
+
+        notificationLib::ConstBufferPtr restored;
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations(2000); i++)
+          restored = notificationLib::StateCodec::decompress(compressed->data(), compressed->size());
+        auto decompressTime = std::chrono::steady_clock::now() - start;
+
+        if (restored == nullptr || *restored != *raw)
+          std::cout << names[c] << ": round trip failed" << std::endl;
+
+        std::cout << std::left << std::setw(12) << stateName
+                  << std::setw(10) << names[c]
+                  << std::setw(10) << raw->size()
+                  << std::setw(10) << compressed->size()
+                  << std::setw(8) << std::fixed << std::setprecision(2)
+                  << static_cast<double>(raw->size()) / compressed->size()
+                  << std::setw(14)
+                  << std::chrono::duration<double, std::micro>(compressTime).count() / iterations(2000)
+                  << std::chrono::duration<double, std::micro>(decompressTime).count() / iterations(2000)
+                  << std::endl;
+      }
+    }
+
+    // Producers take turns to notify, maxMemorySize notifications in
+    // all, and every other state reconciles with the one new entry.
+    // A lagging peer stops syncing for the last round.
+    void
+    timeState(const std::string& stateName, int stateType, int listEncoding,
+              uint64_t keyResolution)
+    {
+      typedef std::set<std::pair<uint64_t,std::vector<uint8_t>>> DiffSet;
+      notificationLib::StateOptions options;
+      options.codec = notificationLib::CodecType::NONE;
+      options.listEncoding = listEncoding;
+      options.keyResolution = keyResolution;
+      // a round takes about 20us per producer: the watermark leaves the
+      // last two rounds listed
+      options.listWatermarkWindow = 2 * 20000 * m_producers;
+      // every diff decodes the state again
+      options.decodedStateCacheSize = 0;
+      std::vector<std::unique_ptr<notificationLib::State>> states;
+      for (int i = 0; i <= m_producers; i++)
+        states.emplace_back(new notificationLib::State(m_memory, stateType, options));
+      notificationLib::State& lagging = *states.back();
+
+      std::vector<Name> events{Name("/benchmark/event")};
+      ndn::time::milliseconds freshness(3600000);
+      size_t rounds = std::max<size_t>(m_memory / m_producers, 1);
+      for (size_t round = 0; round < rounds; round++)
+      {
+        for (int p = 0; p < m_producers; p++)
+        {
+          uint64_t timestamp = states[p]->createKey(events);
+          std::unordered_map<uint64_t,std::vector<Name>> pushed{{timestamp, events}};
+          notificationLib::NotificationData data(pushed);
+          data.m_eventsObj.setProducer(timestamp, states[p]->getProducer(timestamp));
+          auto producerState = states[p]->getState();
+          for (size_t i = 0; i < states.size(); i++)
+          {
+            if (static_cast<int>(i) == p || (&lagging == states[i].get() && round + 1 == rounds))
+              continue;
+            if (!states[i]->reconcile(producerState, data, freshness))
+              std::cout << stateName << ": reconcile failed" << std::endl;
+          }
+          std::this_thread::sleep_for(std::chrono::microseconds(20));
+        }
+      }
+
+      auto encoded = states[0]->getState();
+      auto laggingState = lagging.getState();
+      DiffSet inLocal, inRemote;
+      auto start = std::chrono::steady_clock::now();
+      for (int i = 0; i < iterations(2000); i++)
+      {
+        inLocal.clear();
+        inRemote.clear();
+        if (!states[0]->getDiff(laggingState, inLocal, inRemote))
+          std::cout << stateName << ": diff failed" << std::endl;
+      }
+      auto elapsed = std::chrono::steady_clock::now() - start;
+
+      std::cout << std::left << std::setw(16) << stateName
+                << std::setw(10) << encoded->size()
+                << std::setw(12) << std::fixed << std::setprecision(2)
+                << std::chrono::duration<double, std::micro>(elapsed).count() / iterations(2000)
+                << inLocal.size() << "/" << inRemote.size() << std::endl;
+    }
+
+  private:
+    std::string m_programName;
+    int m_iterations;
+    size_t m_memory;
+    int m_producers;
+  };
+} // namespace ndn
+
+int
+main(int argc, char* argv[])
+{
+  ndn::StateBenchmark benchmark(argv[0]);
+  int option;
+  std::string test;
+
+  while ((option = getopt(argc, argv, "ht:n:m:p:d:")) != -1)
+  {
+    switch (option)
+    {
+      case 't':
+        test = optarg;
+        break;
+      case 'n':
+        benchmark.setIterations(atoi(optarg));
+        break;
+      case 'm':
+        benchmark.setMemory(atoi(optarg));
+        break;
+      case 'p':
+        benchmark.setProducers(std::max(atoi(optarg), 1));
+        break;
+      case 'h':
+        benchmark.usage();
+        break;
+      case 'd':
+        DEBUG = atoi(optarg);
+        break;
+      default:
+        benchmark.usage();
+        break;
+    }
+  }
+
+  if (test == "hash")
+    benchmark.runHash();
+  else if (test == "codec")
+    benchmark.runCodec();
+  else if (test == "state")
+    benchmark.runState();
+  else if (test == "push")
+    benchmark.runPush();
+  else if (test == "snapshot")
+    benchmark.runSnapshot();
+  else if (test == "sketch")
+    benchmark.runSketch();
+  else if (test == "check")
+    return benchmark.runCheck() ? 0 : 1;
+  else
+    benchmark.usage();
+
+  return 0;
+}
@@ -0,0 +1,272 @@
+/* -*- Mode:C++; c-file-style:"bsd"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright 2020 Washington University in St. Louis
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+#include <zdict.h>
+
+#include <../src/state.hpp>
+#include <../src/state-codec.hpp>
+
+// global variable to support debug
+int DEBUG = 0;
+
+namespace ndn {
+  // Trains a zstd dictionary for the codecDictionary setting from
+  // captured states, or from states generated on the spot
+  class StateDictionaryTrainer
+  {
+  public:
+
+    StateDictionaryTrainer(char* programName)
+    : m_programName(programName)
+    , m_dictionarySize(4096)
+    , m_memory(50)
+    , m_generated(0)
+    , m_stateType(notificationLib::StateType::IBF)
+    {
+    }
+
+    void
+    usage()
+    {
+      std::cout << "\n Usage:\n " << m_programName <<
+      ""
+      " [-h] -o dictionary [-s size] [-g IBF|LIST] [-c count] [-m maxMemorySize]\n"
+      "   [-d debug_mode] [state files...]\n"
+      " Train a zstd dictionary for <notification.codecDictionary>.\n"
+      " Each state file holds one captured state, as returned by State::getState()\n"
+      " (the last name component of a notification interest), with any codec.\n"
+      "\n"
+      " \t-h - print this message and exit\n"
+      " \t-o - file to write the dictionary to\n"
+      " \t-s - dictionary size in bytes (default 4096)\n"
+      " \t-g - also generate states of this type to train on\n"
+      " \t-c - number of states to generate (default 500)\n"
+      " \t-m - maxMemorySize of the generated states (default 50)\n"
+      " \t-d - sets the debug mode, 1 - debug on, 0 - debug off (default)\n"
+      "\n";
+      exit(1);
+    }
+
+    void
+    setDictionarySize(size_t size)
+    {
+      m_dictionarySize = size;
+    }
+
+    void
+    setMemory(size_t memory)
+    {
+      m_memory = memory;
+    }
+
+    void
+    setGenerated(int stateType, int count)
+    {
+      m_stateType = stateType;
+      m_generated = count;
+    }
+
+    bool
+    addFile(const std::string& fileName)
+    {
+      std::ifstream input(fileName, std::ios::binary);
+      if (!input)
+      {
+        std::cerr << "cannot open " << fileName << std::endl;
+        return false;
+      }
+      std::vector<uint8_t> captured((std::istreambuf_iterator<char>(input)),
+                                    std::istreambuf_iterator<char>());
+      return addState(captured.data(), captured.size());
+    }
+
+    // Fills states with a random number of notifications, a random
+    // fraction of a millisecond apart
+    void
+    generate()
+    {
+      std::mt19937 rng(1);
+      std::uniform_int_distribution<size_t> fill(1, m_memory);
+      std::uniform_int_distribution<int> gap(0, 200);
+      std::vector<Name> events{Name("/train/event")};
+
+      for (int i = 0; i < m_generated; i++)
+      {
+        notificationLib::State state(m_memory, m_stateType);
+        size_t count = fill(rng);
+        for (size_t k = 0; k < count; k++)
+        {
+          state.createKey(events);
+          std::this_thread::sleep_for(std::chrono::microseconds(gap(rng)));
+        }
+        auto encoded = state.getState();
+        addState(encoded->data(), encoded->size());
+      }
+    }
+
+    // trains the dictionary, writes it and compares zstd with and
+    // without it on the training states
+    bool
+    train(const std::string& output)
+    {
+      if (m_sampleSizes.empty())
+      {
+        std::cerr << "no states to train on" << std::endl;
+        return false;
+      }
+
+      std::vector<uint8_t> dictionary(m_dictionarySize);
+      size_t size = ZDICT_trainFromBuffer(dictionary.data(), dictionary.size(),
+                                          m_samples.data(), m_sampleSizes.data(),
+                                          m_sampleSizes.size());
+      if (ZDICT_isError(size))
+      {
+        std::cerr << "training failed: " << ZDICT_getErrorName(size)
+                  << " (try more states or a smaller -s)" << std::endl;
+        return false;
+      }
+      dictionary.resize(size);
+
+      std::ofstream out(output, std::ios::binary);
+      out.write(reinterpret_cast<const char*>(dictionary.data()), dictionary.size());
+      if (!out)
+      {
+        std::cerr << "cannot write " << output << std::endl;
+        return false;
+      }
+
+      uint32_t dictionaryId = notificationLib::StateCodec::addDictionary(dictionary.data(),
+                                                                          dictionary.size());
+      std::cout << "wrote " << output << ": " << size << " bytes, dictionary id "
+                << dictionaryId << ", " << m_sampleSizes.size() << " states" << std::endl;
+      if (dictionaryId == 0)
+        return false;
+
+      size_t rawTotal = 0, zstdTotal = 0, dictTotal = 0;
+      size_t offset = 0;
+      for (size_t sampleSize : m_sampleSizes)
+      {
+        const uint8_t* sample = m_samples.data() + offset;
+        offset += sampleSize;
+        rawTotal += sampleSize;
+        zstdTotal += notificationLib::StateCodec::compress(notificationLib::CodecType::ZSTD,
+                                                           sample, sampleSize)->size();
+        dictTotal += notificationLib::StateCodec::compress(notificationLib::CodecType::ZSTD_DICT,
+                                                           sample, sampleSize, dictionaryId)->size();
+      }
+      std::cout << "average state: raw " << rawTotal / m_sampleSizes.size()
+                << ", ZSTD " << zstdTotal / m_sampleSizes.size()
+                << ", ZSTD with dictionary " << dictTotal / m_sampleSizes.size()
+                << " bytes" << std::endl;
+      return true;
+    }
+
+  private:
+    // samples are the encoded states before compression
+    bool
+    addState(const uint8_t* captured, size_t capturedSize)
+    {
+      auto raw = notificationLib::StateCodec::decompress(captured, capturedSize);
+      if (raw == nullptr)
+      {
+        std::cerr << "skipping a state that does not decompress" << std::endl;
+        return false;
+      }
+      if (DEBUG)
+        std::cout << "state of " << raw->size() << " bytes" << std::endl;
+      m_samples.insert(m_samples.end(), raw->begin(), raw->end());
+      m_sampleSizes.push_back(raw->size());
+      return true;
+    }
+
+  private:
+    std::string m_programName;
+    size_t m_dictionarySize;
+    size_t m_memory;
+    int m_generated;
+    int m_stateType;
+    std::vector<uint8_t> m_samples;
+    std::vector<size_t> m_sampleSizes;
+  };
+} // namespace ndn
+
+int
+main(int argc, char* argv[])
+{
+  ndn::StateDictionaryTrainer trainer(argv[0]);
+  int option;
+  std::string output;
+  std::string generated;
+  int count = 500;
+
+  while ((option = getopt(argc, argv, "ho:s:g:c:m:d:")) != -1)
+  {
+    switch (option)
+    {
+      case 'o':
+        output = optarg;
+        break;
+      case 's':
+        trainer.setDictionarySize(atoi(optarg));
+        break;
+      case 'g':
+        generated = optarg;
+        break;
+      case 'c':
+        count = atoi(optarg);
+        break;
+      case 'm':
+        trainer.setMemory(atoi(optarg));
+        break;
+      case 'h':
+        trainer.usage();
+        break;
+      case 'd':
+        DEBUG = atoi(optarg);
+        break;
+      default:
+        trainer.usage();
+        break;
+    }
+  }
+
+  if (output.empty())
+    trainer.usage();
+
+  if (generated == "IBF")
+    trainer.setGenerated(notificationLib::StateType::IBF, count);
+  else if (generated == "LIST")
+    trainer.setGenerated(notificationLib::StateType::LIST, count);
+  else if (!generated.empty())
+    trainer.usage();
+
+  for (int i = optind; i < argc; i++)
+    trainer.addFile(argv[i]);
+  trainer.generate();
+
+  return trainer.train(output) ? 0 : 1;
+}
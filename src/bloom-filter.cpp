@@ -0,0 +1,118 @@
+/* -*- Mode:C++; c-file-style:"bsd"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright 2020 Washington University in St. Louis
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bloom-filter.hpp"
+#include "murmurhash3.hpp"
+#include "notificationData.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace notificationLib {
+
+// more hashes cost time and barely lower the rate
+static const uint32_t MAX_HASH_COUNT = 16;
+
+BloomFilter::BloomFilter()
+  : m_hashCount(0)
+{
+}
+
+BloomFilter::BloomFilter(size_t expectedEntries, double falsePositiveRate)
+{
+  // optimal size and hash count for n entries at rate p:
+  // m = -n ln p / (ln 2)^2 bits, k = m/n ln 2 hashes
+  double n = std::max<size_t>(expectedEntries, 1);
+  double ln2 = std::log(2.0);
+  double bits = std::ceil(-n * std::log(falsePositiveRate) / (ln2 * ln2));
+  m_bits.resize(std::max<size_t>((static_cast<size_t>(bits) + 7) / 8, 1));
+  double hashes = std::round(getBitCount() / n * ln2);
+  m_hashCount = std::min<uint32_t>(std::max<double>(hashes, 1), MAX_HASH_COUNT);
+}
+
+void
+BloomFilter::insert(uint64_t key)
+{
+  uint64_t hash = MurmurHash3Mix64(0, key);
+  uint32_t h1 = static_cast<uint32_t>(hash);
+  uint32_t h2 = static_cast<uint32_t>(hash >> 32) | 1;
+  size_t bitCount = getBitCount();
+  for (uint32_t i = 0; i < m_hashCount; i++)
+  {
+    size_t bit = (h1 + static_cast<uint64_t>(i) * h2) % bitCount;
+    m_bits[bit / 8] |= 1 << (bit % 8);
+  }
+}
+
+bool
+BloomFilter::contains(uint64_t key) const
+{
+  if (m_hashCount == 0)
+    return false;
+
+  uint64_t hash = MurmurHash3Mix64(0, key);
+  uint32_t h1 = static_cast<uint32_t>(hash);
+  uint32_t h2 = static_cast<uint32_t>(hash >> 32) | 1;
+  size_t bitCount = getBitCount();
+  for (uint32_t i = 0; i < m_hashCount; i++)
+  {
+    size_t bit = (h1 + static_cast<uint64_t>(i) * h2) % bitCount;
+    if (!(m_bits[bit / 8] & (1 << (bit % 8))))
+      return false;
+  }
+  return true;
+}
+
+Block
+BloomFilter::wireEncode() const
+{
+  EncodingEstimator estimator;
+  size_t estimatedSize = estimator.prependByteArrayBlock(tlv::BloomBits, m_bits.data(), m_bits.size());
+  estimatedSize += prependNonNegativeIntegerBlock(estimator, tlv::BloomHashCount, m_hashCount);
+  estimatedSize += estimator.prependVarNumber(estimatedSize);
+  estimatedSize += estimator.prependVarNumber(tlv::BloomTable);
+
+  EncodingBuffer buffer(estimatedSize);
+  size_t totalLength = buffer.prependByteArrayBlock(tlv::BloomBits, m_bits.data(), m_bits.size());
+  totalLength += prependNonNegativeIntegerBlock(buffer, tlv::BloomHashCount, m_hashCount);
+  totalLength += buffer.prependVarNumber(totalLength);
+  totalLength += buffer.prependVarNumber(tlv::BloomTable);
+  return buffer.block();
+}
+
+bool
+BloomFilter::wireDecode(const Block& wire)
+{
+  if (!wire.hasWire() || wire.type() != tlv::BloomTable)
+    return false;
+
+  wire.parse();
+  auto hashCount = wire.find(tlv::BloomHashCount);
+  auto bits = wire.find(tlv::BloomBits);
+  if (hashCount == wire.elements_end() || bits == wire.elements_end() ||
+      bits->value_size() == 0)
+    return false;
+
+  uint64_t count = readNonNegativeInteger(*hashCount);
+  if (count == 0 || count > MAX_HASH_COUNT)
+    return false;
+  m_hashCount = count;
+  m_bits.assign(bits->value(), bits->value() + bits->value_size());
+  return true;
+}
+
+} // namespace notificationLib
@@ -0,0 +1,75 @@
+/* -*- Mode:C++; c-file-style:"bsd"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright 2020 Washington University in St. Louis
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NOTIFICATIONLIB_BLOOM_FILTER_HPP
+#define NOTIFICATIONLIB_BLOOM_FILTER_HPP
+
+#include "common.hpp"
+
+namespace notificationLib {
+
+/**
+ * Bloom filter of timestamps, the state of StateType::BLOOM.
+ *
+ * Sized for a number of entries and a false positive rate when built;
+ * the bit and hash counts travel with the filter, so peers with other
+ * settings read it as is. Indexes are derived from one 64-bit hash of
+ * the key (Kirsch-Mitzenmacher double hashing).
+ */
+class BloomFilter
+{
+public:
+  // an empty filter that contains nothing, for wireDecode
+  BloomFilter();
+
+  BloomFilter(size_t expectedEntries, double falsePositiveRate);
+
+  void
+  insert(uint64_t key);
+
+  // false positives at about the rate the filter was built for
+  bool
+  contains(uint64_t key) const;
+
+  size_t
+  getBitCount() const
+  {
+    return m_bits.size() * 8;
+  }
+
+  uint32_t
+  getHashCount() const
+  {
+    return m_hashCount;
+  }
+
+  // tlv::BloomTable: hash count, then the bits
+  Block
+  wireEncode() const;
+
+  // false if wire is not a well formed tlv::BloomTable
+  bool
+  wireDecode(const Block& wire);
+
+private:
+  std::vector<uint8_t> m_bits;
+  uint32_t m_hashCount;
+};
+
+} // namespace notificationLib
+
+#endif // NOTIFICATIONLIB_BLOOM_FILTER_HPP
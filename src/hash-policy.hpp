@@ -0,0 +1,128 @@
+/* -*- Mode:C++; c-file-style:"bsd"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright 2020 Washington University in St. Louis
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+#ifndef NOTIFICATIONLIB_HASH_POLICY_HPP
+#define NOTIFICATIONLIB_HASH_POLICY_HPP
+
+#include "murmurhash3.hpp"
+#include <inttypes.h>
+
+namespace notificationLib
+{
+
+// Hash scheme used to place keys in an IBF. Both sides of a diff
+// must use the same one; it is carried in the encoded table.
+// Every scheme but MURMUR3 derives all indices of a key from one
+// 64-bit hash (see the policies below).
+namespace HashType
+{
+  enum
+  {
+    MURMUR3 = 1,        // MurmurHash3 (x86_32), one pass per seed (legacy)
+    MURMUR3_DOUBLE = 2, // MurmurHash3 64-bit finalizer
+    XXH3 = 3,           // xxHash3 (XXH3_64bits_withSeed)
+    WYHASH = 4          // wyhash (final version 4)
+  };
+}
+
+// Hash policies for 8-byte keys. Each maps a key to 64 bits as if its
+// little-endian bytes were hashed, so results do not depend on the host.
+
+struct Murmur3Hash
+{
+  static uint64_t
+  hash64(uint64_t seed, uint64_t key)
+  {
+    return MurmurHash3Mix64(seed, key);
+  }
+};
+
+struct Xxh3Hash
+{
+  // XXH3_64bits_withSeed() on 8 bytes: the 4-8 byte path with the
+  // default secret folded into constants
+  static uint64_t
+  hash64(uint64_t seed, uint64_t key)
+  {
+    uint32_t s = static_cast<uint32_t>(seed);
+    s = (s << 24) | ((s << 8) & 0x00ff0000) | ((s >> 8) & 0x0000ff00) | (s >> 24);
+    seed ^= static_cast<uint64_t>(s) << 32;
+
+    uint64_t bitflip = (0x1cad21f72c81017cULL ^ 0xdb979083e96dd4deULL) - seed;
+    uint64_t input64 = (key >> 32) + (key << 32);
+    uint64_t h = input64 ^ bitflip;
+
+    h ^= ((h << 49) | (h >> 15)) ^ ((h << 24) | (h >> 40));
+    h *= 0x9fb21c651e98df25ULL;
+    h ^= (h >> 35) + 8;
+    h *= 0x9fb21c651e98df25ULL;
+    return h ^ (h >> 28);
+  }
+};
+
+struct WyHash
+{
+  // wyhash() on 8 bytes with the default secret
+  static uint64_t
+  hash64(uint64_t seed, uint64_t key)
+  {
+    seed ^= mix(seed ^ 0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL);
+
+    uint64_t lo = key & 0xffffffff;
+    uint64_t hi = key >> 32;
+    uint64_t a = (lo << 32) | hi;
+    uint64_t b = (hi << 32) | lo;
+
+    a ^= 0x8bb84b93962eacc9ULL;
+    b ^= seed;
+    mum(a, b);
+    return mix(a ^ 0x2d358dccaa6c78a5ULL ^ 8, b ^ 0x8bb84b93962eacc9ULL);
+  }
+
+private:
+  // 64x64->128 multiply, low half in a and high half in b
+  static void
+  mum(uint64_t& a, uint64_t& b)
+  {
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = a;
+    r *= b;
+    a = static_cast<uint64_t>(r);
+    b = static_cast<uint64_t>(r >> 64);
+#else
+    uint64_t ha = a >> 32, hb = b >> 32, la = a & 0xffffffff, lb = b & 0xffffffff;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32), c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+    a = lo;
+    b = hi;
+#endif
+  }
+
+  static uint64_t
+  mix(uint64_t a, uint64_t b)
+  {
+    mum(a, b);
+    return a ^ b;
+  }
+};
+
+} // namespace notificationLib
+
+#endif // NOTIFICATIONLIB_HASH_POLICY_HPP
@@ -0,0 +1,71 @@
+/* -*- Mode:C++; c-file-style:"bsd"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright 2020 Washington University in St. Louis
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hybrid-clock.hpp"
+
+namespace notificationLib {
+
+static const uint64_t LOGICAL_MASK = (1ULL << HybridClock::LOGICAL_BITS) - 1;
+static const uint32_t COUNTER_MASK = (1U << HybridClock::COUNTER_BITS) - 1;
+
+HybridClock::HybridClock(uint32_t node, uint64_t maxDrift)
+  : m_physical(0)
+  , m_counter(0)
+  , m_node(node & ((1U << NODE_BITS) - 1))
+  , m_maxDrift(maxDrift)
+{
+}
+
+uint64_t
+HybridClock::next(uint64_t physicalNs)
+{
+  uint64_t physical = physicalNs & ~LOGICAL_MASK;
+  if (physical > m_physical)
+  {
+    m_physical = physical;
+    m_counter = 0;
+  }
+  else if (++m_counter > COUNTER_MASK)
+  {
+    // more keys in one tick than the counter holds: borrow the next
+    // tick, the physical clock catches up with it soon enough
+    m_physical += LOGICAL_MASK + 1;
+    m_counter = 0;
+  }
+  return m_physical | (static_cast<uint64_t>(m_counter) << NODE_BITS) | m_node;
+}
+
+bool
+HybridClock::observe(uint64_t key, uint64_t physicalNs)
+{
+  // a node whose clock runs far ahead would drag every key after it
+  if (key > physicalNs && key - physicalNs > m_maxDrift)
+    return false;
+
+  uint64_t physical = key & ~LOGICAL_MASK;
+  uint32_t counter = (key >> NODE_BITS) & COUNTER_MASK;
+  if (physical > m_physical)
+  {
+    m_physical = physical;
+    m_counter = counter;
+  }
+  else if (physical == m_physical && counter > m_counter)
+    m_counter = counter;
+  return true;
+}
+
+} // namespace notificationLib
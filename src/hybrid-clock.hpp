@@ -0,0 +1,72 @@
+/* -*- Mode:C++; c-file-style:"bsd"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright 2020 Washington University in St. Louis
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NOTIFICATIONLIB_HYBRID_CLOCK_HPP
+#define NOTIFICATIONLIB_HYBRID_CLOCK_HPP
+
+#include "common.hpp"
+
+namespace notificationLib {
+
+/**
+ * Hybrid logical clock for notification keys.
+ *
+ * A key is the physical time in ns with its low LOGICAL_BITS replaced by
+ * a logical counter and a node id. The keys of one clock strictly
+ * increase, also within a clock tick, when the clock steps back, or
+ * after a later key from another node was observed; keys of two nodes
+ * differ unless they drew the same node id. Keys still read as ns since
+ * the epoch, to within about a millisecond, so freshness works as
+ * before.
+ */
+class HybridClock
+{
+public:
+  static const int NODE_BITS = 12;
+  static const int COUNTER_BITS = 8;
+  static const int LOGICAL_BITS = NODE_BITS + COUNTER_BITS;
+
+  // only the low NODE_BITS of node are used; keys more than maxDrift ns
+  // ahead of the physical clock are not observed
+  HybridClock(uint32_t node, uint64_t maxDrift);
+
+  // a key above every key issued or observed so far
+  uint64_t
+  next(uint64_t physicalNs);
+
+  // moves the clock past key, from any node, unless key is more than
+  // maxDrift ahead of physicalNs; returns false if it was ignored
+  bool
+  observe(uint64_t key, uint64_t physicalNs);
+
+  uint32_t
+  getNode() const
+  {
+    return m_node;
+  }
+
+private:
+  // physical part of the latest key, low LOGICAL_BITS clear
+  uint64_t m_physical;
+  uint32_t m_counter;
+  uint32_t m_node;
+  uint64_t m_maxDrift;
+};
+
+} // namespace notificationLib
+
+#endif // NOTIFICATIONLIB_HYBRID_CLOCK_HPP
@@ -19,7 +19,9 @@
 // Invertibe Bloom Fiter (IBF)
 //
 // see https://github.com/gavinandresen/IBFT_Cplusplus for more details
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <iostream>
 #include <list>
 #include <sstream>
@@ -33,20 +35,67 @@ namespace notificationLib {
 static const size_t N_HASH = 4;
 static const size_t N_HASHCHECK = 11;
 
-template<typename T>
-std::vector<uint8_t> ToVec(T number)
+static uint32_t checkFromHash64(uint64_t h)
 {
-  std::vector<uint8_t> v(sizeof(T));
-  for (size_t i = 0; i < sizeof(T); i++) {
-      v.at(i) = (number >> i*8) & 0xff;
+  return static_cast<uint32_t>((h * 0x9e3779b97f4a7c15ULL) >> 32);
+}
+
+// Derives the bucket of k in each of the N_HASH sub-tables from a single
+// 64-bit hash as h1 + i*h2 (Kirsch-Mitzenmacher), mapped into the
+// sub-table with a multiply-shift, and returns the key check.
+template<class HashPolicy>
+static uint32_t hashKeyDouble(uint64_t k, size_t bucketsPerHash, size_t index[N_HASH])
+{
+  uint64_t h = HashPolicy::hash64(N_HASHCHECK, k);
+  uint32_t h1 = static_cast<uint32_t>(h);
+  uint32_t h2 = static_cast<uint32_t>(h >> 32) | 1;
+  for (uint32_t i = 0; i < N_HASH; i++) {
+    uint32_t hi = h1 + i*h2;
+    index[i] = static_cast<size_t>((static_cast<uint64_t>(hi) * bucketsPerHash) >> 32);
+  }
+  return checkFromHash64(h);
+}
+
+// Computes the bucket of k in each of the N_HASH sub-tables and returns
+// the key check. HashType::MURMUR3 hashes k once per seed (0..N_HASH-1,
+// then N_HASHCHECK); the other types go through hashKeyDouble.
+static uint32_t hashKey(int hashType, uint64_t k, size_t bucketsPerHash, size_t index[N_HASH])
+{
+  switch (hashType) {
+  case HashType::MURMUR3_DOUBLE:
+    return hashKeyDouble<Murmur3Hash>(k, bucketsPerHash, index);
+  case HashType::XXH3:
+    return hashKeyDouble<Xxh3Hash>(k, bucketsPerHash, index);
+  case HashType::WYHASH:
+    return hashKeyDouble<WyHash>(k, bucketsPerHash, index);
+  default:
+    break;
+  }
+
+  for (size_t i = 0; i < N_HASH; i++) {
+    index[i] = MurmurHash3(i, k) % bucketsPerHash;
+  }
+  return MurmurHash3(N_HASHCHECK, k);
+}
+
+static uint32_t computeKeyCheck(int hashType, uint64_t k)
+{
+  switch (hashType) {
+  case HashType::MURMUR3_DOUBLE:
+    return checkFromHash64(Murmur3Hash::hash64(N_HASHCHECK, k));
+  case HashType::XXH3:
+    return checkFromHash64(Xxh3Hash::hash64(N_HASHCHECK, k));
+  case HashType::WYHASH:
+    return checkFromHash64(WyHash::hash64(N_HASHCHECK, k));
+  default:
+    return MurmurHash3(N_HASHCHECK, k);
   }
-  return v;
 }
 
-bool IBFT::HashTableEntry::isPure() const
+bool IBFT::HashTableEntry::isPure(int hashType) const
 {
   if (count == 1 || count == -1) {
-      uint32_t check = MurmurHash3(N_HASHCHECK, ToVec(keySum));
+      uint32_t check = computeKeyCheck(hashType, keySum);
       return (keyCheck == check);
   }
   return false;
@@ -70,8 +119,11 @@ void IBFT::HashTableEntry::addValue(const std::vector<uint8_t> v)
   }
 }
 
-IBFT::IBFT(size_t _expectedNumEntries, size_t _valueSize) :
-    valueSize(_valueSize)
+IBFT::IBFT(size_t _expectedNumEntries, size_t _valueSize, int _hashType) :
+    valueSize(_valueSize),
+    hashType(_hashType),
+    keyBase(0),
+    keyResolution(0)
 {
   // 1.5x expectedNumEntries gives very low probability of
   // decoding failure
@@ -85,10 +137,13 @@ IBFT::IBFT(size_t _expectedNumEntries, size_t _valueSize) :
 IBFT::IBFT(const IBFT& other)
 {
   valueSize = other.valueSize;
+  hashType = other.hashType;
+  keyBase = other.keyBase;
+  keyResolution = other.keyResolution;
   m_hashTable = other.m_hashTable;
 }
 
-IBFT::IBFT(std::shared_ptr<ndn::Buffer> buf, size_t _expectedNumEntries, size_t _valueSize)
+IBFT::IBFT(ConstBufferPtr buf, size_t _expectedNumEntries, size_t _valueSize)
   : IBFT(_expectedNumEntries, _valueSize)
 {
   Block bufferBlock = Block(buf);
@@ -103,17 +158,17 @@ void IBFT::_insert(int plusOrMinus, uint64_t k, const std::vector<uint8_t> v)
 {
   assert(v.size() == valueSize);
 
-  std::vector<uint8_t> kvec = ToVec(k);
-
   size_t bucketsPerHash = m_hashTable.size()/N_HASH;
+  size_t index[N_HASH];
+  uint32_t check = hashKey(hashType, k, bucketsPerHash, index);
+
   for (size_t i = 0; i < N_HASH; i++) {
     size_t startEntry = i*bucketsPerHash;
 
-    uint32_t h = MurmurHash3(i, kvec);
-    IBFT::HashTableEntry& entry = m_hashTable.at(startEntry + (h%bucketsPerHash));
+    IBFT::HashTableEntry& entry = m_hashTable.at(startEntry + index[i]);
     entry.count += plusOrMinus;
     entry.keySum ^= k;
-    entry.keyCheck ^= MurmurHash3(N_HASHCHECK, kvec);
+    entry.keyCheck ^= check;
     if (entry.empty()) {
       entry.valueSum.clear();
     }
@@ -138,21 +193,21 @@ bool IBFT::get(uint64_t k, std::vector<uint8_t>& result) const
 {
   result.clear();
 
-  std::vector<uint8_t> kvec = ToVec(k);
-
   size_t bucketsPerHash = m_hashTable.size()/N_HASH;
+  size_t index[N_HASH];
+  hashKey(hashType, k, bucketsPerHash, index);
+
   for (size_t i = 0; i < N_HASH; i++) {
     size_t startEntry = i*bucketsPerHash;
 
-    uint32_t h = MurmurHash3(i, kvec);
-    const IBFT::HashTableEntry& entry = m_hashTable.at(startEntry + (h%bucketsPerHash));
+    const IBFT::HashTableEntry& entry = m_hashTable.at(startEntry + index[i]);
 
     if (entry.empty()) {
       // Definitely not in table. Leave
       // result empty, return true.
       return true;
     }
-    else if (entry.isPure()) {
+    else if (entry.isPure(hashType)) {
       if (entry.keySum == k) {
         // Found!
         result.assign(entry.valueSum.begin(), entry.valueSum.end());
@@ -171,7 +226,7 @@ bool IBFT::get(uint64_t k, std::vector<uint8_t>& result) const
   size_t nErased = 0;
   for (size_t i = 0; i < peeled.m_hashTable.size(); i++) {
     IBFT::HashTableEntry& entry = peeled.m_hashTable.at(i);
-    if (entry.isPure()) {
+    if (entry.isPure(hashType)) {
       if (entry.keySum == k) {
         // Found!
         result.assign(entry.valueSum.begin(), entry.valueSum.end());
@@ -198,7 +253,7 @@ bool IBFT::listEntries(std::set<std::pair<uint64_t,std::vector<uint8_t> > >& pos
     nErased = 0;
     for (size_t i = 0; i < peeled.m_hashTable.size(); i++) {
       IBFT::HashTableEntry& entry = peeled.m_hashTable.at(i);
-      if (entry.isPure()) {
+      if (entry.isPure(hashType)) {
         if (entry.count == 1) {
           positive.insert(std::make_pair(entry.keySum, entry.valueSum));
         }
@@ -219,10 +274,16 @@ bool IBFT::listEntries(std::set<std::pair<uint64_t,std::vector<uint8_t> > >& pos
   return true;
 }
 
+bool IBFT::isSupportedHashType(int type)
+{
+  return (type >= HashType::MURMUR3 && type <= HashType::WYHASH);
+}
+
 IBFT IBFT::operator-(const IBFT& other) const
 {
   // IBFT's must be same params/size:
   assert(valueSize == other.valueSize);
+  assert(hashType == other.hashType);
   assert(m_hashTable.size() == other.m_hashTable.size());
 
   IBFT result(*this);
@@ -254,7 +315,7 @@ std::string IBFT::DumpTable() const
   for (size_t i = 0; i < m_hashTable.size(); i++) {
     const IBFT::HashTableEntry& entry = m_hashTable.at(i);
     result << entry.count << " " << entry.keySum << " ";
-    result << (MurmurHash3(N_HASHCHECK, ToVec(entry.keySum)) == entry.keyCheck ? "true" : "false");
+    result << (computeKeyCheck(hashType, entry.keySum) == entry.keyCheck ? "true" : "false");
     result << " " << sizeof(entry);
     result << "\n";
   }
@@ -282,6 +343,65 @@ uint8_t* IBFT::getIBFBuffer() const
   return((uint8_t*)(m_hashTable.data()));
 }
 
+static const size_t CELL_HEADER_SIZE = 24;
+
+size_t IBFT::getCellImageSize() const
+{
+  // values are not always valueSize long (see State), the slot fits
+  // the longest
+  size_t longest = valueSize;
+  for (auto const& entry: m_hashTable)
+    longest = std::max(longest, entry.valueSum.size());
+  return m_hashTable.size() * (CELL_HEADER_SIZE + ((longest + 7) & ~static_cast<size_t>(7)));
+}
+
+void IBFT::writeCellImage(uint8_t* image) const
+{
+  size_t size = getCellImageSize();
+  if (size == 0)
+    return;
+  size_t cellSize = size / m_hashTable.size();
+  std::memset(image, 0, size);
+  for (auto const& entry: m_hashTable)
+  {
+    uint32_t valueLength = entry.valueSum.size();
+    std::memcpy(image, &entry.count, 4);
+    std::memcpy(image + 4, &entry.keyCheck, 4);
+    std::memcpy(image + 8, &entry.keySum, 8);
+    std::memcpy(image + 16, &valueLength, 4);
+    std::copy(entry.valueSum.begin(), entry.valueSum.end(), image + CELL_HEADER_SIZE);
+    image += cellSize;
+  }
+}
+
+bool IBFT::readCellImage(const uint8_t* image, size_t cellCount, size_t size)
+{
+  if (cellCount != m_hashTable.size() || size % cellCount != 0 ||
+      size / m_hashTable.size() < CELL_HEADER_SIZE)
+    return false;
+
+  size_t cellSize = size / m_hashTable.size();
+  for (size_t i = 0; i < m_hashTable.size(); i++)
+  {
+    uint32_t valueLength;
+    std::memcpy(&valueLength, image + i * cellSize + 16, 4);
+    if (valueLength > cellSize - CELL_HEADER_SIZE)
+      return false;
+  }
+
+  for (auto& entry: m_hashTable)
+  {
+    uint32_t valueLength;
+    std::memcpy(&entry.count, image, 4);
+    std::memcpy(&entry.keyCheck, image + 4, 4);
+    std::memcpy(&entry.keySum, image + 8, 8);
+    std::memcpy(&valueLength, image + 16, 4);
+    entry.valueSum.assign(image + CELL_HEADER_SIZE, image + CELL_HEADER_SIZE + valueLength);
+    image += cellSize;
+  }
+  return true;
+}
+
 std::string IBFT::dumpItems() const
 {
   std::ostringstream result;
@@ -323,6 +443,15 @@ IBFT::wireEncode(EncodingImpl<T>& encoder) const
     }
     ++i;
   }
+  // legacy tables carry no hash type so older peers can still read them
+  if (hashType != HashType::MURMUR3)
+    totalLength += prependNonNegativeIntegerBlock(encoder, tlv::IBFHashType, hashType);
+  if (keyResolution != 0)
+  {
+    totalLength += prependNonNegativeIntegerBlock(encoder, tlv::KeyResolution, keyResolution);
+    totalLength += prependNonNegativeIntegerBlock(encoder, tlv::KeyBase, keyBase);
+  }
+
   totalLength += encoder.prependVarNumber(totalLength);
   totalLength += encoder.prependVarNumber(tlv::IBFTable);
   return totalLength;
@@ -354,11 +483,26 @@ IBFT::wireDecode(const Block& wire)
 
   wire.parse();
 
+  // tables without a hash type were built with the legacy scheme
+  hashType = HashType::MURMUR3;
+  keyBase = 0;
+  keyResolution = 0;
+
   // for each entry
   for (Block::element_const_iterator it = wire.elements_begin();
        it != wire.elements_end(); it++)
   {
-    if (it->type() == tlv::IBFEntry)
+    if (it->type() == tlv::IBFHashType)
+    {
+      hashType = readNonNegativeInteger(*it);
+      if (!isSupportedHashType(hashType))
+        std::cerr << "Unsupported IBF hash type: " << hashType << std::endl;
+    }
+    else if (it->type() == tlv::KeyBase)
+      keyBase = readNonNegativeInteger(*it);
+    else if (it->type() == tlv::KeyResolution)
+      keyResolution = readNonNegativeInteger(*it);
+    else if (it->type() == tlv::IBFEntry)
     {
       it->parse();
 
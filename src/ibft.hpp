@@ -23,6 +23,7 @@
 #define IBFT_H
 
 #include "common.hpp"
+#include "hash-policy.hpp"
 #include <inttypes.h>
 #include <set>
 #include <vector>
@@ -45,11 +46,11 @@ namespace notificationLib
 class IBFT
 {
 public:
-    IBFT(size_t _expectedNumEntries, size_t _ValueSize);
+    IBFT(size_t _expectedNumEntries, size_t _ValueSize, int _hashType = HashType::MURMUR3);
     IBFT(const IBFT& other);
     // IBFT(const std::string& strIBF, size_t _valueSize);
     // IBFT(const char* buffer, size_t bufferSize, size_t _valueSize);
-    IBFT(std::shared_ptr<ndn::Buffer>, size_t _expectedNumEntries, size_t _valueSize);
+    IBFT(ConstBufferPtr, size_t _expectedNumEntries, size_t _valueSize);
     virtual ~IBFT();
 
     void insert(uint64_t k, const std::vector<uint8_t> v);
@@ -72,6 +73,32 @@ public:
     // Subtract two IBFTs
     IBFT operator-(const IBFT& other) const;
 
+    int getHashType() const
+    {
+      return hashType;
+    }
+
+    static bool isSupportedHashType(int type);
+
+    // Keys relative to a base: key k stands for keyBase + k * keyResolution.
+    // Only carried on the wire for the table's users, a resolution of 0
+    // means the keys are absolute (the legacy format).
+    void setKeyBase(uint64_t base, uint64_t resolution)
+    {
+      keyBase = base;
+      keyResolution = resolution;
+    }
+
+    uint64_t getKeyBase() const
+    {
+      return keyBase;
+    }
+
+    uint64_t getKeyResolution() const
+    {
+      return keyResolution;
+    }
+
     // For debugging:
     std::string DumpTable() const;
 
@@ -80,6 +107,23 @@ public:
 
     uint8_t* getIBFBuffer() const;
 
+    // Fixed-width image of the cells, for state files: per cell int32
+    // count, uint32 keyCheck, uint64 keySum, uint32 value length, 4
+    // bytes of padding, then the value sum in a slot as wide as the
+    // longest one, rounded up to 8 bytes
+    size_t getCellImageSize() const;
+
+    size_t getCellCount() const
+    {
+      return m_hashTable.size();
+    }
+
+    void writeCellImage(uint8_t* image) const;
+
+    // false (and the table unchanged) if image is not one of a table of
+    // our size
+    bool readCellImage(const uint8_t* image, size_t cellCount, size_t size);
+
     std::string dumpItems() const;
 
     // for encoding and decoding
@@ -96,6 +140,9 @@ private:
     void _insert(int plusOrMinus, uint64_t k, const std::vector<uint8_t> v);
 
     size_t valueSize;
+    int hashType;
+    uint64_t keyBase;
+    uint64_t keyResolution;
     //size_t numOfStoredElements;
     class HashTableEntry
     {
@@ -105,7 +152,7 @@ private:
         uint32_t keyCheck;
         std::vector<uint8_t> valueSum;
 
-        bool isPure() const;
+        bool isPure(int hashType) const;
         bool empty() const;
         void addValue(const std::vector<uint8_t> v);
     };
@@ -27,21 +27,27 @@ inline uint32_t ROTL32 ( uint32_t x, int8_t r )
 }
 
 uint32_t MurmurHash3(uint32_t nHashSeed, const std::vector<unsigned char>& vDataToHash)
+{
+    return MurmurHash3(nHashSeed, vDataToHash.data(), vDataToHash.size());
+}
+
+uint32_t MurmurHash3(uint32_t nHashSeed, const uint8_t* pDataToHash, std::size_t nLen)
 {
     // The following is MurmurHash3 (x86_32), see http://code.google.com/p/smhasher/source/browse/trunk/MurmurHash3.cpp
     uint32_t h1 = nHashSeed;
     const uint32_t c1 = 0xcc9e2d51;
     const uint32_t c2 = 0x1b873593;
 
-    const std::size_t nblocks = vDataToHash.size() / 4;
+    const std::size_t nblocks = nLen / 4;
 
     //----------
     // body
-    const uint32_t * blocks = (const uint32_t *)(&vDataToHash[0] + nblocks*4);
-
-    for(std::size_t i = -nblocks; i; i++)
+    // blocks are read byte-wise (little-endian) so the input may be unaligned
+    for(std::size_t i = 0; i < nblocks; i++)
     {
-        uint32_t k1 = blocks[i];
+        const uint8_t * block = pDataToHash + i*4;
+        uint32_t k1 = uint32_t(block[0]) | (uint32_t(block[1]) << 8) |
+                      (uint32_t(block[2]) << 16) | (uint32_t(block[3]) << 24);
 
         k1 *= c1;
         k1 = ROTL32(k1,15);
@@ -54,11 +60,11 @@ uint32_t MurmurHash3(uint32_t nHashSeed, const std::vector<unsigned char>& vData
 
     //----------
     // tail
-    const uint8_t * tail = (const uint8_t*)(&vDataToHash[0] + nblocks*4);
+    const uint8_t * tail = pDataToHash + nblocks*4;
 
     uint32_t k1 = 0;
 
-    switch(vDataToHash.size() & 3)
+    switch(nLen & 3)
     {
     case 3: k1 ^= tail[2] << 16;
     case 2: k1 ^= tail[1] << 8;
@@ -68,7 +74,7 @@ uint32_t MurmurHash3(uint32_t nHashSeed, const std::vector<unsigned char>& vData
 
     //----------
     // finalization
-    h1 ^= vDataToHash.size();
+    h1 ^= nLen;
     h1 ^= h1 >> 16;
     h1 *= 0x85ebca6b;
     h1 ^= h1 >> 13;
@@ -24,8 +24,52 @@
 #define MURMURHASH3_H
 
 #include <inttypes.h>
+#include <cstddef>
 #include <vector>
 
 extern uint32_t MurmurHash3(uint32_t nHashSeed, const std::vector<unsigned char>& vDataToHash);
 
+extern uint32_t MurmurHash3(uint32_t nHashSeed, const uint8_t* pDataToHash, std::size_t nLen);
+
+// MurmurHash3 (x86_32) of the 8 little-endian bytes of nKey. Produces the
+// same value as hashing a vector holding those bytes, without building one.
+inline uint32_t MurmurHash3(uint32_t nHashSeed, uint64_t nKey)
+{
+    const uint32_t c1 = 0xcc9e2d51;
+    const uint32_t c2 = 0x1b873593;
+
+    uint32_t h1 = nHashSeed;
+    uint32_t k1 = static_cast<uint32_t>(nKey);
+    uint32_t k2 = static_cast<uint32_t>(nKey >> 32);
+
+    k1 *= c1; k1 = (k1 << 15) | (k1 >> 17); k1 *= c2;
+    h1 ^= k1; h1 = (h1 << 13) | (h1 >> 19); h1 = h1*5+0xe6546b64;
+
+    k2 *= c1; k2 = (k2 << 15) | (k2 >> 17); k2 *= c2;
+    h1 ^= k2; h1 = (h1 << 13) | (h1 >> 19); h1 = h1*5+0xe6546b64;
+
+    h1 ^= 8;
+    h1 ^= h1 >> 16;
+    h1 *= 0x85ebca6b;
+    h1 ^= h1 >> 13;
+    h1 *= 0xc2b2ae35;
+    h1 ^= h1 >> 16;
+
+    return h1;
+}
+
+// MurmurHash3 64-bit finalizer (fmix64) of nKey mixed with nHashSeed.
+// A single call yields 64 well-mixed bits, enough to derive every IBF
+// index of a key by double hashing.
+inline uint64_t MurmurHash3Mix64(uint64_t nHashSeed, uint64_t nKey)
+{
+    uint64_t k = nKey ^ (nHashSeed * 0x9e3779b97f4a7c15ULL);
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
 #endif /* MURMURHASH3_H */
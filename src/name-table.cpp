@@ -0,0 +1,94 @@
+/* -*- Mode:C++; c-file-style:"bsd"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright 2020 Washington University in St. Louis
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "name-table.hpp"
+
+namespace notificationLib {
+
+NameTable&
+NameTable::instance()
+{
+  static NameTable table;
+  return table;
+}
+
+uint32_t
+NameTable::acquire(const Name& name)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_ids.find(name);
+  if (it != m_ids.end())
+  {
+    m_entries[it->second - 1].refCount++;
+    return it->second;
+  }
+
+  uint32_t id;
+  if (!m_freeIds.empty())
+  {
+    id = m_freeIds.back();
+    m_freeIds.pop_back();
+  }
+  else
+  {
+    m_entries.push_back(Entry());
+    id = m_entries.size();
+  }
+  // own copy of the wire, so the packet a name was decoded from is
+  // not kept alive by the table
+  Entry& entry = m_entries[id - 1];
+  entry.name = Name(Block(name.wireEncode().wire(), name.wireEncode().size()));
+  entry.refCount = 1;
+  m_ids[entry.name] = id;
+  return id;
+}
+
+void
+NameTable::addRef(uint32_t id)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_entries[id - 1].refCount++;
+}
+
+void
+NameTable::release(uint32_t id)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  Entry& entry = m_entries[id - 1];
+  if (--entry.refCount == 0)
+  {
+    m_ids.erase(entry.name);
+    entry.name = Name();
+    m_freeIds.push_back(id);
+  }
+}
+
+const Name&
+NameTable::get(uint32_t id) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_entries[id - 1].name;
+}
+
+size_t
+NameTable::size() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_ids.size();
+}
+
+} // namespace notificationLib
@@ -0,0 +1,76 @@
+/* -*- Mode:C++; c-file-style:"bsd"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright 2020 Washington University in St. Louis
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NOTIFICATIONLIB_NAME_TABLE_HPP
+#define NOTIFICATIONLIB_NAME_TABLE_HPP
+
+#include "common.hpp"
+#include <deque>
+#include <map>
+#include <mutex>
+
+namespace notificationLib {
+
+/**
+ * Per-process table of interned event names.
+ *
+ * Producers publish the same few event names over and over; each one
+ * is stored once here and referred to by a small id with a reference
+ * count. Two interned names are equal iff their ids are equal. An id
+ * is recycled once its last reference is released.
+ */
+class NameTable : noncopyable
+{
+public:
+  static NameTable&
+  instance();
+
+  // id of name, taking a reference (ids start at 1)
+  uint32_t
+  acquire(const Name& name);
+
+  void
+  addRef(uint32_t id);
+
+  void
+  release(uint32_t id);
+
+  // only valid while a reference to id is held
+  const Name&
+  get(uint32_t id) const;
+
+  // number of distinct names held
+  size_t
+  size() const;
+
+private:
+  struct Entry
+  {
+    Name name;
+    uint32_t refCount;
+  };
+
+  mutable std::mutex m_mutex;
+  // deque: entries do not move when the table grows
+  std::deque<Entry> m_entries;
+  std::vector<uint32_t> m_freeIds;
+  std::map<Name, uint32_t> m_ids;
+};
+
+} // namespace notificationLib
+
+#endif // NOTIFICATIONLIB_NAME_TABLE_HPP
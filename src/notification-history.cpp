@@ -0,0 +1,299 @@
+/* -*- Mode:C++; c-file-style:"bsd"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright 2020 Washington University in St. Louis
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "notification-history.hpp"
+
+#include <algorithm>
+
+namespace notificationLib {
+
+static const size_t RECORD_HEADER_SIZE = 8;
+
+static size_t
+alignRecord(size_t size)
+{
+  return (size + 7) & ~static_cast<size_t>(7);
+}
+
+static void
+writeHeader(uint8_t* record, uint32_t size, uint32_t live)
+{
+  std::memcpy(record, &size, 4);
+  std::memcpy(record + 4, &live, 4);
+}
+
+static void
+readHeader(const uint8_t* record, uint32_t& size, uint32_t& live)
+{
+  std::memcpy(&size, record, 4);
+  std::memcpy(&live, record + 4, 4);
+}
+
+static uint32_t
+readCount(const uint8_t* record)
+{
+  uint32_t count;
+  std::memcpy(&count, record + RECORD_HEADER_SIZE, 4);
+  return count;
+}
+
+static const uint8_t*
+idsOf(const uint8_t* record)
+{
+  return record + RECORD_HEADER_SIZE + 4;
+}
+
+NotificationHistory::NotificationHistory(size_t initialArenaSize)
+  : m_arena(alignRecord(std::max<size_t>(initialArenaSize, 64)))
+  , m_head(0)
+  , m_tail(0)
+  , m_liveBytes(0)
+{
+}
+
+NotificationHistory::NotificationHistory(const NotificationHistory& other)
+  : m_arena(other.m_arena)
+  , m_head(other.m_head)
+  , m_tail(other.m_tail)
+  , m_index(other.m_index)
+  , m_liveBytes(other.m_liveBytes)
+{
+  for (auto const& entry: m_index)
+  {
+    const uint8_t* record = _at(entry.offset);
+    uint32_t count = readCount(record);
+    const uint8_t* ids = idsOf(record);
+    for (uint32_t i = 0; i < count; i++)
+    {
+      uint32_t id;
+      std::memcpy(&id, ids + 4 * i, 4);
+      NameTable::instance().addRef(id);
+    }
+  }
+}
+
+NotificationHistory::~NotificationHistory()
+{
+  for (auto const& entry: m_index)
+    _releaseRecord(entry.offset);
+}
+
+std::deque<NotificationHistory::IndexEntry>::iterator
+NotificationHistory::_lowerBound(uint64_t timestamp)
+{
+  return std::lower_bound(m_index.begin(), m_index.end(), timestamp,
+                          [] (const IndexEntry& entry, uint64_t t) {
+                            return entry.timestamp < t;
+                          });
+}
+
+std::deque<NotificationHistory::IndexEntry>::const_iterator
+NotificationHistory::_lowerBound(uint64_t timestamp) const
+{
+  return std::lower_bound(m_index.begin(), m_index.end(), timestamp,
+                          [] (const IndexEntry& entry, uint64_t t) {
+                            return entry.timestamp < t;
+                          });
+}
+
+void
+NotificationHistory::insert(uint64_t timestamp, const std::vector<Name>& eventList)
+{
+  size_t recordSize = alignRecord(RECORD_HEADER_SIZE + 4 * (eventList.size() + 1));
+  uint64_t offset = _allocate(recordSize);
+  uint8_t* record = _at(offset);
+  writeHeader(record, recordSize, 1);
+  uint32_t count = eventList.size();
+  std::memcpy(record + RECORD_HEADER_SIZE, &count, 4);
+  uint8_t* ids = record + RECORD_HEADER_SIZE + 4;
+  size_t bytes = recordSize + sizeof(IndexEntry);
+  for (auto const& name: eventList)
+  {
+    uint32_t id = NameTable::instance().acquire(name);
+    std::memcpy(ids, &id, 4);
+    ids += 4;
+    bytes += name.wireEncode().size();
+  }
+  m_liveBytes += bytes;
+
+  // timestamps almost always arrive in order
+  if (m_index.empty() || m_index.back().timestamp < timestamp)
+  {
+    m_index.push_back(IndexEntry{timestamp, offset});
+    return;
+  }
+
+  auto it = _lowerBound(timestamp);
+  if (it != m_index.end() && it->timestamp == timestamp)
+  {
+    // replace: the old record becomes garbage for the tail to skip
+    _releaseRecord(it->offset);
+    it->offset = offset;
+    _advanceTail();
+  }
+  else
+    m_index.insert(it, IndexEntry{timestamp, offset});
+}
+
+bool
+NotificationHistory::erase(uint64_t timestamp)
+{
+  auto it = _lowerBound(timestamp);
+  if (it == m_index.end() || it->timestamp != timestamp)
+    return false;
+
+  _releaseRecord(it->offset);
+  m_index.erase(it);
+  _advanceTail();
+  return true;
+}
+
+bool
+NotificationHistory::contains(uint64_t timestamp) const
+{
+  auto it = _lowerBound(timestamp);
+  return it != m_index.end() && it->timestamp == timestamp;
+}
+
+std::vector<Name>
+NotificationHistory::find(uint64_t timestamp) const
+{
+  EventListView events = view(timestamp);
+  std::vector<Name> eventList;
+  eventList.reserve(events.size());
+  for (size_t i = 0; i < events.size(); i++)
+    eventList.push_back(events[i]);
+  return eventList;
+}
+
+NotificationHistory::EventListView
+NotificationHistory::view(uint64_t timestamp) const
+{
+  auto it = _lowerBound(timestamp);
+  if (it == m_index.end() || it->timestamp != timestamp)
+    return EventListView();
+
+  const uint8_t* record = _at(it->offset);
+  return EventListView(idsOf(record), readCount(record));
+}
+
+std::vector<uint64_t>
+NotificationHistory::timestamps() const
+{
+  std::vector<uint64_t> result;
+  result.reserve(m_index.size());
+  for (auto const& entry: m_index)
+    result.push_back(entry.timestamp);
+  return result;
+}
+
+std::vector<uint64_t>
+NotificationHistory::timestampsAfter(uint64_t timestamp) const
+{
+  std::vector<uint64_t> result;
+  auto it = std::upper_bound(m_index.begin(), m_index.end(), timestamp,
+                             [] (uint64_t t, const IndexEntry& entry) {
+                               return t < entry.timestamp;
+                             });
+  result.reserve(m_index.end() - it);
+  for (; it != m_index.end(); ++it)
+    result.push_back(it->timestamp);
+  return result;
+}
+
+uint64_t
+NotificationHistory::_allocate(size_t recordSize)
+{
+  size_t position = m_head % m_arena.size();
+  size_t padding = position + recordSize > m_arena.size() ? m_arena.size() - position : 0;
+  if ((m_head - m_tail) + padding + recordSize > m_arena.size())
+  {
+    _grow(recordSize);
+    position = m_head % m_arena.size();
+    padding = position + recordSize > m_arena.size() ? m_arena.size() - position : 0;
+  }
+
+  // records never wrap, skip the end of the arena with a dead record
+  if (padding > 0)
+  {
+    writeHeader(_at(m_head), padding, 0);
+    m_head += padding;
+  }
+  uint64_t offset = m_head;
+  m_head += recordSize;
+  return offset;
+}
+
+void
+NotificationHistory::_grow(size_t recordSize)
+{
+  // live records are compacted to the start of the new arena
+  size_t needed = (m_head - m_tail) + 2 * recordSize;
+  std::vector<uint8_t> arena(alignRecord(std::max(m_arena.size() * 2, needed)));
+  uint64_t offset = 0;
+  for (auto& entry: m_index)
+  {
+    uint32_t size, live;
+    const uint8_t* record = _at(entry.offset);
+    readHeader(record, size, live);
+    std::copy(record, record + size, arena.data() + offset);
+    entry.offset = offset;
+    offset += size;
+  }
+  m_arena.swap(arena);
+  m_tail = 0;
+  m_head = offset;
+}
+
+void
+NotificationHistory::_releaseRecord(uint64_t offset)
+{
+  uint32_t size, live;
+  uint8_t* record = _at(offset);
+  readHeader(record, size, live);
+
+  uint32_t count = readCount(record);
+  const uint8_t* ids = idsOf(record);
+  size_t bytes = size + sizeof(IndexEntry);
+  for (uint32_t i = 0; i < count; i++)
+  {
+    uint32_t id;
+    std::memcpy(&id, ids + 4 * i, 4);
+    // the same names as insert counted
+    bytes += NameTable::instance().get(id).wireEncode().size();
+    NameTable::instance().release(id);
+  }
+  m_liveBytes -= bytes;
+  writeHeader(record, size, 0);
+}
+
+void
+NotificationHistory::_advanceTail()
+{
+  while (m_tail < m_head)
+  {
+    uint32_t size, live;
+    readHeader(_at(m_tail), size, live);
+    if (live)
+      break;
+    m_tail += size;
+  }
+  if (m_tail == m_head)
+    m_tail = m_head = 0;
+}
+
+} // namespace notificationLib
@@ -0,0 +1,232 @@
+/* -*- Mode:C++; c-file-style:"bsd"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright 2020 Washington University in St. Louis
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NOTIFICATIONLIB_NOTIFICATION_HISTORY_HPP
+#define NOTIFICATIONLIB_NOTIFICATION_HISTORY_HPP
+
+#include "common.hpp"
+#include "name-table.hpp"
+
+#include <cstring>
+#include <deque>
+
+namespace notificationLib {
+
+/**
+ * Event lists of the live notifications of a State, by timestamp.
+ *
+ * Event lists are stored as interned name ids (see NameTable) in one
+ * byte arena used as a ring: inserts append at the head and the tail
+ * advances over records that were erased, which is the common case
+ * since timestamps arrive nearly in order and expire in order. A sorted index of
+ * (timestamp, arena offset) pairs serves lookups by binary search and
+ * ordered iteration; the occasional out-of-order timestamp (from a
+ * remote producer) is inserted in place.
+ *
+ * A copy takes its own references to the names of the live records,
+ * so it stays valid whatever happens to the original.
+ */
+class NotificationHistory
+{
+public:
+  /**
+   * Read-only view of a stored event list. The names are the interned
+   * ones, nothing is copied; the view is valid until the history is
+   * next modified.
+   */
+  class EventListView
+  {
+  public:
+    EventListView()
+      : m_ids(nullptr)
+      , m_size(0)
+    {
+    }
+
+    EventListView(const uint8_t* ids, size_t size)
+      : m_ids(ids)
+      , m_size(size)
+    {
+    }
+
+    size_t
+    size() const
+    {
+      return m_size;
+    }
+
+    bool
+    empty() const
+    {
+      return m_size == 0;
+    }
+
+    const Name&
+    operator[](size_t i) const
+    {
+      uint32_t id;
+      std::memcpy(&id, m_ids + i * sizeof(id), sizeof(id));
+      return NameTable::instance().get(id);
+    }
+
+  private:
+    const uint8_t* m_ids;
+    size_t m_size;
+  };
+
+  explicit
+  NotificationHistory(size_t initialArenaSize = 4096);
+
+  NotificationHistory(const NotificationHistory& other);
+
+  NotificationHistory&
+  operator=(const NotificationHistory&) = delete;
+
+  ~NotificationHistory();
+
+  // replaces the event list if timestamp is already present
+  void
+  insert(uint64_t timestamp, const std::vector<Name>& eventList);
+
+  // returns false if timestamp is not present
+  bool
+  erase(uint64_t timestamp);
+
+  bool
+  contains(uint64_t timestamp) const;
+
+  // empty if timestamp is not present
+  std::vector<Name>
+  find(uint64_t timestamp) const;
+
+  // empty if timestamp is not present
+  EventListView
+  view(uint64_t timestamp) const;
+
+  size_t
+  size() const
+  {
+    return m_index.size();
+  }
+
+  bool
+  empty() const
+  {
+    return m_index.empty();
+  }
+
+  // only valid if not empty
+  uint64_t
+  oldest() const
+  {
+    return m_index.front().timestamp;
+  }
+
+  // only valid if not empty
+  uint64_t
+  newest() const
+  {
+    return m_index.back().timestamp;
+  }
+
+  // live timestamps in ascending order
+  std::vector<uint64_t>
+  timestamps() const;
+
+  // live timestamps above timestamp, in ascending order
+  std::vector<uint64_t>
+  timestampsAfter(uint64_t timestamp) const;
+
+  // calls f with each live timestamp up to timestamp, in ascending
+  // order, without copying them
+  template<typename F>
+  void
+  forEachUpTo(uint64_t timestamp, F f) const
+  {
+    for (auto const& entry: m_index)
+    {
+      if (entry.timestamp > timestamp)
+        break;
+      f(entry.timestamp);
+    }
+  }
+
+  // bytes the live notifications account for: record, index entry and
+  // the wire of every name they hold (a shared name counts for each)
+  size_t
+  bytesUsed() const
+  {
+    return m_liveBytes;
+  }
+
+private:
+  struct IndexEntry
+  {
+    uint64_t timestamp;
+    uint64_t offset; // absolute arena offset of the record
+  };
+
+  std::deque<IndexEntry>::iterator
+  _lowerBound(uint64_t timestamp);
+
+  std::deque<IndexEntry>::const_iterator
+  _lowerBound(uint64_t timestamp) const;
+
+  // reserves a contiguous record of recordSize bytes at the head
+  uint64_t
+  _allocate(size_t recordSize);
+
+  void
+  _grow(size_t recordSize);
+
+  // drops the name references of a record, takes it out of
+  // m_liveBytes and marks it erased
+  void
+  _releaseRecord(uint64_t offset);
+
+  // moves the tail over erased records
+  void
+  _advanceTail();
+
+  uint8_t*
+  _at(uint64_t offset)
+  {
+    return m_arena.data() + offset % m_arena.size();
+  }
+
+  const uint8_t*
+  _at(uint64_t offset) const
+  {
+    return m_arena.data() + offset % m_arena.size();
+  }
+
+private:
+  // record: [uint32 size incl. header][uint32 live][payload][padding to 8]
+  // payload: [uint32 count][uint32 name id]..., fixed width so a view
+  // can index it
+  std::vector<uint8_t> m_arena;
+  uint64_t m_head;
+  uint64_t m_tail;
+  std::deque<IndexEntry> m_index;
+  // kept per record: the arena also holds erased records until the
+  // tail passes them, which is not in timestamp order
+  size_t m_liveBytes;
+};
+
+} // namespace notificationLib
+
+#endif // NOTIFICATIONLIB_NOTIFICATION_HISTORY_HPP
@@ -0,0 +1,355 @@
+/* -*- Mode:C++; c-file-style:"bsd"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright 2020 Washington University in St. Louis
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "notification-log.hpp"
+#include "logger.hpp"
+#include "murmurhash3.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+INIT_LOGGER(notificationLog);
+
+namespace notificationLib {
+
+static const char SEGMENT_SUFFIX[] = ".wal";
+static const size_t SEGMENT_DIGITS = 20;
+// [uint32 size][uint32 checksum], the size and checksum cover the rest
+static const size_t RECORD_HEADER_SIZE = 8;
+// [uint64 timestamp][uint32 name count]
+static const size_t RECORD_FIXED_SIZE = 12;
+
+static void
+appendValue(std::vector<uint8_t>& out, const void* value, size_t size)
+{
+  const uint8_t* bytes = static_cast<const uint8_t*>(value);
+  out.insert(out.end(), bytes, bytes + size);
+}
+
+static std::string
+segmentName(uint64_t firstTimestamp)
+{
+  char name[SEGMENT_DIGITS + sizeof(SEGMENT_SUFFIX)];
+  std::snprintf(name, sizeof(name), "%020llu%s",
+                static_cast<unsigned long long>(firstTimestamp), SEGMENT_SUFFIX);
+  return name;
+}
+
+// false if name is not a segment
+static bool
+parseSegmentName(const std::string& name, uint64_t& firstTimestamp)
+{
+  if (name.size() != SEGMENT_DIGITS + sizeof(SEGMENT_SUFFIX) - 1 ||
+      name.compare(SEGMENT_DIGITS, std::string::npos, SEGMENT_SUFFIX) != 0)
+    return false;
+  firstTimestamp = 0;
+  for (size_t i = 0; i < SEGMENT_DIGITS; i++)
+  {
+    if (name[i] < '0' || name[i] > '9')
+      return false;
+    firstTimestamp = firstTimestamp * 10 + (name[i] - '0');
+  }
+  return true;
+}
+
+static bool
+readFile(const std::string& path, std::vector<uint8_t>& content)
+{
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  uint8_t buffer[65536];
+  while (true)
+  {
+    ssize_t count = ::read(fd, buffer, sizeof(buffer));
+    if (count < 0 && errno == EINTR)
+      continue;
+    if (count < 0)
+    {
+      ::close(fd);
+      return false;
+    }
+    if (count == 0)
+      break;
+    content.insert(content.end(), buffer, buffer + count);
+  }
+  ::close(fd);
+  return true;
+}
+
+static void
+syncDirectory(const std::string& directory)
+{
+  int fd = ::open(directory.c_str(), O_RDONLY);
+  if (fd >= 0)
+  {
+    ::fsync(fd);
+    ::close(fd);
+  }
+}
+
+NotificationLog::NotificationLog(const std::string& directory, uint64_t segmentSpan)
+  : m_directory(directory)
+  , m_segmentSpan(segmentSpan)
+  , m_fd(-1)
+{
+  if (::mkdir(m_directory.c_str(), 0755) != 0 && errno != EEXIST)
+    _LOG_ERROR("NotificationLog: cannot create " << m_directory << ": " << std::strerror(errno));
+
+  DIR* dir = ::opendir(m_directory.c_str());
+  if (dir == nullptr)
+  {
+    _LOG_ERROR("NotificationLog: cannot read " << m_directory << ": " << std::strerror(errno));
+    return;
+  }
+  while (struct dirent* entry = ::readdir(dir))
+  {
+    uint64_t firstTimestamp;
+    if (parseSegmentName(entry->d_name, firstTimestamp))
+      m_segments.push_back(Segment{firstTimestamp, m_directory + "/" + entry->d_name});
+  }
+  ::closedir(dir);
+  std::sort(m_segments.begin(), m_segments.end(),
+            [] (const Segment& a, const Segment& b) {
+              return a.firstTimestamp < b.firstTimestamp;
+            });
+}
+
+NotificationLog::~NotificationLog()
+{
+  if (m_fd >= 0)
+    ::close(m_fd);
+}
+
+void
+NotificationLog::encode(std::vector<uint8_t>& batch, uint64_t timestamp,
+                        const std::vector<Name>& eventList)
+{
+  size_t start = batch.size();
+  batch.resize(start + RECORD_HEADER_SIZE);
+  appendValue(batch, &timestamp, sizeof(timestamp));
+  uint32_t count = eventList.size();
+  appendValue(batch, &count, sizeof(count));
+  for (auto const& name: eventList)
+  {
+    const Block& wire = name.wireEncode();
+    uint32_t size = wire.size();
+    appendValue(batch, &size, sizeof(size));
+    batch.insert(batch.end(), wire.wire(), wire.wire() + wire.size());
+  }
+
+  uint32_t size = batch.size() - start - RECORD_HEADER_SIZE;
+  uint32_t checksum = MurmurHash3(0, batch.data() + start + RECORD_HEADER_SIZE, size);
+  std::memcpy(batch.data() + start, &size, sizeof(size));
+  std::memcpy(batch.data() + start + sizeof(size), &checksum, sizeof(checksum));
+}
+
+size_t
+NotificationLog::replay(const function<void(uint64_t, const std::vector<Name>&)>& onRecord) const
+{
+  size_t nRecords = 0;
+  for (auto const& segment: m_segments)
+  {
+    std::vector<uint8_t> content;
+    if (!readFile(segment.path, content))
+    {
+      _LOG_ERROR("NotificationLog::replay: cannot read " << segment.path << ": "
+                 << std::strerror(errno));
+      continue;
+    }
+
+    size_t offset = 0;
+    while (content.size() - offset >= RECORD_HEADER_SIZE + RECORD_FIXED_SIZE)
+    {
+      const uint8_t* record = content.data() + offset;
+      uint32_t size, checksum;
+      std::memcpy(&size, record, sizeof(size));
+      std::memcpy(&checksum, record + sizeof(size), sizeof(checksum));
+      if (size < RECORD_FIXED_SIZE || size > content.size() - offset - RECORD_HEADER_SIZE ||
+          MurmurHash3(0, record + RECORD_HEADER_SIZE, size) != checksum)
+        break;
+
+      const uint8_t* field = record + RECORD_HEADER_SIZE;
+      const uint8_t* end = field + size;
+      uint64_t timestamp;
+      uint32_t count;
+      std::memcpy(&timestamp, field, sizeof(timestamp));
+      std::memcpy(&count, field + sizeof(timestamp), sizeof(count));
+      field += RECORD_FIXED_SIZE;
+
+      std::vector<Name> eventList;
+      bool isValid = true;
+      for (uint32_t i = 0; i < count && isValid; i++)
+      {
+        uint32_t nameSize;
+        if (end - field < static_cast<ptrdiff_t>(sizeof(nameSize)))
+        {
+          isValid = false;
+          break;
+        }
+        std::memcpy(&nameSize, field, sizeof(nameSize));
+        field += sizeof(nameSize);
+        if (static_cast<size_t>(end - field) < nameSize)
+        {
+          isValid = false;
+          break;
+        }
+        try
+        {
+          eventList.push_back(Name(Block(field, nameSize)));
+        }
+        catch (const std::exception& e)
+        {
+          isValid = false;
+        }
+        field += nameSize;
+      }
+      // the checksum matched, so this is a bug rather than a torn write
+      if (!isValid || field != end)
+      {
+        _LOG_ERROR("NotificationLog::replay: bad record in " << segment.path);
+        break;
+      }
+
+      onRecord(timestamp, eventList);
+      nRecords++;
+      offset += RECORD_HEADER_SIZE + size;
+    }
+    if (offset != content.size())
+      _LOG_INFO("NotificationLog::replay: " << content.size() - offset
+                << " bytes of a torn record dropped from " << segment.path);
+  }
+  return nRecords;
+}
+
+bool
+NotificationLog::commit(const std::vector<uint8_t>& batch)
+{
+  // records are written a run at a time, a run ending where a record
+  // has to start a new segment
+  size_t runStart = 0;
+  size_t offset = 0;
+  while (offset < batch.size())
+  {
+    uint32_t size;
+    uint64_t timestamp;
+    std::memcpy(&size, batch.data() + offset, sizeof(size));
+    std::memcpy(&timestamp, batch.data() + offset + RECORD_HEADER_SIZE, sizeof(timestamp));
+
+    if (m_fd < 0 || timestamp >= m_segments.back().firstTimestamp + m_segmentSpan)
+    {
+      if (!_write(batch.data() + runStart, offset - runStart) || !_rotate(timestamp))
+        return _abandonSegment();
+      runStart = offset;
+    }
+    offset += RECORD_HEADER_SIZE + size;
+  }
+  if (!_write(batch.data() + runStart, offset - runStart))
+    return _abandonSegment();
+
+  // the one sync of the batch
+  if (m_fd >= 0 && ::fdatasync(m_fd) != 0)
+  {
+    _LOG_ERROR("NotificationLog::commit: cannot sync " << m_segments.back().path << ": "
+               << std::strerror(errno));
+    return _abandonSegment();
+  }
+  return true;
+}
+
+bool
+NotificationLog::_abandonSegment()
+{
+  // a partial record may end the segment, records after it would not
+  // be replayed
+  if (m_fd >= 0)
+  {
+    ::close(m_fd);
+    m_fd = -1;
+  }
+  return false;
+}
+
+bool
+NotificationLog::_rotate(uint64_t timestamp)
+{
+  if (m_fd >= 0)
+  {
+    // the records already written to it are part of this batch
+    if (::fdatasync(m_fd) != 0)
+    {
+      _LOG_ERROR("NotificationLog: cannot sync " << m_segments.back().path << ": "
+                 << std::strerror(errno));
+      return false;
+    }
+    ::close(m_fd);
+    m_fd = -1;
+  }
+
+  // never appended to: after a restart the last segment may end in a
+  // torn record
+  uint64_t firstTimestamp = timestamp;
+  if (!m_segments.empty())
+    firstTimestamp = std::max(firstTimestamp, m_segments.back().firstTimestamp + 1);
+  std::string path = m_directory + "/" + segmentName(firstTimestamp);
+  m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_APPEND, 0644);
+  if (m_fd < 0)
+  {
+    _LOG_ERROR("NotificationLog: cannot create " << path << ": " << std::strerror(errno));
+    return false;
+  }
+  m_segments.push_back(Segment{firstTimestamp, path});
+
+  // a segment holds records below the first timestamp of the next one
+  while (m_segments.size() > 1 && m_segments[1].firstTimestamp + m_segmentSpan <= timestamp)
+  {
+    ::unlink(m_segments.front().path.c_str());
+    m_segments.pop_front();
+  }
+  // the new segment has to be found after a crash
+  syncDirectory(m_directory);
+  return true;
+}
+
+bool
+NotificationLog::_write(const uint8_t* data, size_t size)
+{
+  while (size > 0)
+  {
+    ssize_t written = ::write(m_fd, data, size);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written <= 0)
+    {
+      _LOG_ERROR("NotificationLog: cannot write " << m_segments.back().path << ": "
+                 << std::strerror(errno));
+      return false;
+    }
+    data += written;
+    size -= written;
+  }
+  return true;
+}
+
+} // namespace notificationLib
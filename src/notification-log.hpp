@@ -0,0 +1,101 @@
+/* -*- Mode:C++; c-file-style:"bsd"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright 2020 Washington University in St. Louis
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NOTIFICATIONLIB_NOTIFICATION_LOG_HPP
+#define NOTIFICATIONLIB_NOTIFICATION_LOG_HPP
+
+#include "common.hpp"
+
+#include <deque>
+
+namespace notificationLib {
+
+/**
+ * Write-ahead log of the notifications a producer creates (walDirectory),
+ * replayed into its State after a crash.
+ *
+ * Records go to segment files named after the first timestamp they
+ * hold. A new segment is started once the current one spans
+ * segmentSpan (memoryFreshness), and a segment is removed once every
+ * record in it has expired, so the log holds about two freshness
+ * windows. A record is [uint32 size of the rest][uint32 MurmurHash3 of
+ * the rest][uint64 timestamp][uint32 name count] then each name as
+ * [uint32 size][name TLV]; replay of a segment stops at the first
+ * record that is cut short or fails its checksum (the tail a crash
+ * left), and new records always go to a new segment.
+ *
+ * Group commit: records are encoded into a batch by the caller, and a
+ * batch is written and synced with one fsync by commit(), which may run
+ * on another thread (one commit at a time).
+ */
+class NotificationLog : noncopyable
+{
+public:
+  // segmentSpan in ns
+  NotificationLog(const std::string& directory, uint64_t segmentSpan);
+
+  ~NotificationLog();
+
+  // appends the record of a notification to batch
+  static void
+  encode(std::vector<uint8_t>& batch, uint64_t timestamp, const std::vector<Name>& eventList);
+
+  // calls onRecord for every complete record, oldest first; before the
+  // first commit. Returns the number of records.
+  size_t
+  replay(const function<void(uint64_t, const std::vector<Name>&)>& onRecord) const;
+
+  // writes batch and syncs it; false on an I/O error
+  bool
+  commit(const std::vector<uint8_t>& batch);
+
+  size_t
+  getSegmentCount() const
+  {
+    return m_segments.size();
+  }
+
+private:
+  struct Segment
+  {
+    uint64_t firstTimestamp;
+    std::string path;
+  };
+
+  // opens a new segment starting at timestamp, then removes the
+  // segments whose records all lie more than a span before it
+  bool
+  _rotate(uint64_t timestamp);
+
+  bool
+  _write(const uint8_t* data, size_t size);
+
+  // after a failed write, the next commit starts a new segment; false
+  bool
+  _abandonSegment();
+
+private:
+  std::string m_directory;
+  uint64_t m_segmentSpan;
+  // oldest first, the last one is written to if m_fd is open
+  std::deque<Segment> m_segments;
+  int m_fd;
+};
+
+} // namespace notificationLib
+
+#endif // NOTIFICATIONLIB_NOTIFICATION_LOG_HPP
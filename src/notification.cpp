@@ -30,6 +30,7 @@ Notification::Notification(const Name& name,
                           bool isListener,
                           bool isProvider,
                           int stateType,
+                          const StateOptions& stateOptions,
                           ndn::Face& face,
                           NotificationAPICallback notificationCB)
   : m_notificationName(name)
@@ -42,6 +43,7 @@ Notification::Notification(const Name& name,
                            memoryFreshness,
                            lifetime,
                            stateType,
+                           stateOptions,
                            notificationCB,
                            api::DEFAULT_NAME,
                            api::DEFAULT_VALIDATOR,
@@ -130,11 +132,203 @@ Notification::create(const ConfigSection& configSection,
     stateType = StateType::TUPLE;
   else if(propertyIt->second.data() == "LIST")
     stateType = StateType::LIST;
+  else if(propertyIt->second.data() == "BLOOM")
+    stateType = StateType::BLOOM;
+  else if(propertyIt->second.data() == "RANGE")
+    stateType = StateType::RANGE;
+  else if(propertyIt->second.data() == "SKETCH")
+    stateType = StateType::SKETCH;
   else
-    BOOST_THROW_EXCEPTION(Error("Expecting IBF, LIST or TUPLE for <notification.stateType>"));
+    BOOST_THROW_EXCEPTION(Error("Expecting IBF, LIST, TUPLE, BLOOM, RANGE or SKETCH for <notification.stateType>"));
 
   propertyIt++;
 
+  // Optional state settings, in any order, up to <notification.event>
+  StateOptions stateOptions;
+  for (; propertyIt != configSection.end() && !boost::iequals(propertyIt->first, "event"); propertyIt++)
+  {
+    if (boost::iequals(propertyIt->first, "hashType"))
+    {
+      if(propertyIt->second.data() == "MURMUR3")
+        stateOptions.hashType = HashType::MURMUR3;
+      else if(propertyIt->second.data() == "MURMUR3_DOUBLE")
+        stateOptions.hashType = HashType::MURMUR3_DOUBLE;
+      else if(propertyIt->second.data() == "XXH3")
+        stateOptions.hashType = HashType::XXH3;
+      else if(propertyIt->second.data() == "WYHASH")
+        stateOptions.hashType = HashType::WYHASH;
+      else
+        BOOST_THROW_EXCEPTION(Error("Expecting MURMUR3, MURMUR3_DOUBLE, XXH3 or WYHASH for <notification.hashType>"));
+    }
+    else if (boost::iequals(propertyIt->first, "listEncoding"))
+    {
+      if(propertyIt->second.data() == "TLV")
+        stateOptions.listEncoding = ListEncoding::TLV;
+      else if(propertyIt->second.data() == "DELTA")
+        stateOptions.listEncoding = ListEncoding::DELTA;
+      else if(propertyIt->second.data() == "WATERMARK")
+        stateOptions.listEncoding = ListEncoding::WATERMARK;
+      else
+        BOOST_THROW_EXCEPTION(Error("Expecting TLV, DELTA or WATERMARK for <notification.listEncoding>"));
+    }
+    else if (boost::iequals(propertyIt->first, "listWatermarkWindow"))
+    {
+      // in nanoseconds, like the timestamps themselves
+      stateOptions.listWatermarkWindow = std::stoull(propertyIt->second.data());
+    }
+    else if (boost::iequals(propertyIt->first, "listResolution"))
+    {
+      // in nanoseconds, like the timestamps themselves
+      stateOptions.listResolution = std::stoull(propertyIt->second.data());
+      if (stateOptions.listResolution == 0)
+        BOOST_THROW_EXCEPTION(Error("Expecting a positive number for <notification.listResolution>"));
+    }
+    else if (boost::iequals(propertyIt->first, "codec"))
+    {
+      if(propertyIt->second.data() == "BZIP2")
+        stateOptions.codec = CodecType::BZIP2;
+      else if(propertyIt->second.data() == "NONE")
+        stateOptions.codec = CodecType::NONE;
+      else if(propertyIt->second.data() == "LZ4")
+        stateOptions.codec = CodecType::LZ4;
+      else if(propertyIt->second.data() == "ZSTD")
+        stateOptions.codec = CodecType::ZSTD;
+      else if(propertyIt->second.data() == "DEFLATE")
+        stateOptions.codec = CodecType::DEFLATE;
+      else
+        BOOST_THROW_EXCEPTION(Error("Expecting BZIP2, NONE, LZ4, ZSTD or DEFLATE for <notification.codec>"));
+
+      if (!StateCodec::isSupported(stateOptions.codec))
+        BOOST_THROW_EXCEPTION(Error("<notification.codec> " + propertyIt->second.data() +
+                                    " is not available in this build"));
+    }
+    else if (boost::iequals(propertyIt->first, "maxMemoryBytes"))
+    {
+      stateOptions.maxMemoryBytes = std::stoull(propertyIt->second.data());
+    }
+    else if (boost::iequals(propertyIt->first, "codecDictionary"))
+    {
+      // zstd dictionary from trainStateDictionary, relative to the config file
+      std::string fileName = propertyIt->second.data();
+      size_t slash = configFilename.rfind('/');
+      if (!fileName.empty() && fileName[0] != '/' && slash != std::string::npos)
+        fileName = configFilename.substr(0, slash + 1) + fileName;
+
+      stateOptions.codec = CodecType::ZSTD_DICT;
+      stateOptions.dictionaryId = StateCodec::loadDictionary(fileName);
+      if (stateOptions.dictionaryId == 0)
+        BOOST_THROW_EXCEPTION(Error("Unable to load <notification.codecDictionary> " + fileName));
+    }
+    else if (boost::iequals(propertyIt->first, "interestState"))
+    {
+      if(propertyIt->second.data() == "FULL")
+        stateOptions.interestState = InterestState::FULL;
+      else if(propertyIt->second.data() == "DIGEST")
+        stateOptions.interestState = InterestState::DIGEST;
+      else
+        BOOST_THROW_EXCEPTION(Error("Expecting FULL or DIGEST for <notification.interestState>"));
+    }
+    else if (boost::iequals(propertyIt->first, "decodedStateCache"))
+    {
+      stateOptions.decodedStateCacheSize = std::stoull(propertyIt->second.data());
+    }
+    else if (boost::iequals(propertyIt->first, "keyResolution"))
+    {
+      // in nanoseconds, like the timestamps themselves
+      stateOptions.keyResolution = std::stoull(propertyIt->second.data());
+      if (stateOptions.keyResolution > 1000000000)
+        BOOST_THROW_EXCEPTION(Error("Expecting at most 1000000000 for <notification.keyResolution>"));
+    }
+    else if (boost::iequals(propertyIt->first, "bloomFalsePositiveRate"))
+    {
+      stateOptions.bloomFalsePositiveRate = std::stod(propertyIt->second.data());
+      if (!(stateOptions.bloomFalsePositiveRate > 0 && stateOptions.bloomFalsePositiveRate < 1))
+        BOOST_THROW_EXCEPTION(Error("Expecting a number between 0 and 1 for <notification.bloomFalsePositiveRate>"));
+    }
+    else if (boost::iequals(propertyIt->first, "rangeLeafSize"))
+    {
+      stateOptions.rangeLeafSize = std::stoull(propertyIt->second.data());
+      if (stateOptions.rangeLeafSize == 0)
+        BOOST_THROW_EXCEPTION(Error("Expecting a positive number for <notification.rangeLeafSize>"));
+    }
+    else if (boost::iequals(propertyIt->first, "sketchCapacity"))
+    {
+      stateOptions.sketchCapacity = std::stoull(propertyIt->second.data());
+      if (stateOptions.sketchCapacity == 0 || stateOptions.sketchCapacity > 1000)
+        BOOST_THROW_EXCEPTION(Error("Expecting a number between 1 and 1000 for <notification.sketchCapacity>"));
+    }
+    else if (boost::iequals(propertyIt->first, "snapshotFile"))
+    {
+      // relative to the config file, as codecDictionary
+      std::string fileName = propertyIt->second.data();
+      size_t slash = configFilename.rfind('/');
+      if (!fileName.empty() && fileName[0] != '/' && slash != std::string::npos)
+        fileName = configFilename.substr(0, slash + 1) + fileName;
+      stateOptions.snapshotFile = fileName;
+    }
+    else if (boost::iequals(propertyIt->first, "snapshotInterval"))
+    {
+      // seconds, as memoryFreshness
+      stateOptions.snapshotInterval = std::stoull(propertyIt->second.data()) * 1000;
+      if (stateOptions.snapshotInterval == 0)
+        BOOST_THROW_EXCEPTION(Error("Expecting a positive number for <notification.snapshotInterval>"));
+    }
+    else if (boost::iequals(propertyIt->first, "walDirectory"))
+    {
+      std::string directory = propertyIt->second.data();
+      size_t slash = configFilename.rfind('/');
+      if (!directory.empty() && directory[0] != '/' && slash != std::string::npos)
+        directory = configFilename.substr(0, slash + 1) + directory;
+      stateOptions.walDirectory = directory;
+    }
+    else if (boost::iequals(propertyIt->first, "walSyncInterval"))
+    {
+      // milliseconds: it bounds the delay of every notification
+      stateOptions.walSyncInterval = std::stoull(propertyIt->second.data());
+    }
+    else if (boost::iequals(propertyIt->first, "walBatchSize"))
+    {
+      stateOptions.walBatchSize = std::stoull(propertyIt->second.data());
+      if (stateOptions.walBatchSize == 0)
+        BOOST_THROW_EXCEPTION(Error("Expecting a positive number for <notification.walBatchSize>"));
+    }
+    else if (boost::iequals(propertyIt->first, "keyClock"))
+    {
+      if(propertyIt->second.data() == "WALL")
+        stateOptions.keyClock = KeyClock::WALL;
+      else if(propertyIt->second.data() == "HYBRID")
+        stateOptions.keyClock = KeyClock::HYBRID;
+      else
+        BOOST_THROW_EXCEPTION(Error("Expecting WALL or HYBRID for <notification.keyClock>"));
+    }
+    else if (boost::iequals(propertyIt->first, "keyNode"))
+    {
+      uint64_t node = std::stoull(propertyIt->second.data());
+      if (node >= (1u << HybridClock::NODE_BITS))
+        BOOST_THROW_EXCEPTION(Error("Expecting a number below " +
+                                    std::to_string(1u << HybridClock::NODE_BITS) +
+                                    " for <notification.keyNode>"));
+      stateOptions.keyNode = node;
+    }
+    else if (boost::iequals(propertyIt->first, "keyMaxDrift"))
+    {
+      // in nanoseconds, like the timestamps themselves
+      stateOptions.keyMaxDrift = std::stoull(propertyIt->second.data());
+    }
+    else
+      BOOST_THROW_EXCEPTION(Error("Unexpected <notification." + propertyIt->first + ">"));
+  }
+
+  // hybrid keys carry their counter and node id in the low bits
+  if (stateOptions.keyClock == KeyClock::HYBRID && stateOptions.keyResolution > 1)
+    BOOST_THROW_EXCEPTION(Error("<notification.keyClock> HYBRID needs <notification.keyResolution> 0 or 1"));
+
+  // live timestamps, and peers' up to memoryFreshness ahead of our
+  // clock, must fit above a key base that moves with the newest of them
+  if (stateOptions.keyResolution != 0 &&
+      2 * static_cast<uint64_t>(memoryFreshness) * 1000000 >= (stateOptions.keyResolution << 31))
+    BOOST_THROW_EXCEPTION(Error("<notification.memoryFreshness> is too long for <notification.keyResolution>"));
+
   auto notification = make_unique<Notification>(name,
                                                 maxNotificationMemory,
                                                 time::milliseconds(memoryFreshness),
@@ -142,6 +336,7 @@ Notification::create(const ConfigSection& configSection,
                                                 isListener,
                                                 isProvider,
                                                 stateType,
+                                                stateOptions,
                                                 face,
                                                 notificationCB);
 
@@ -39,6 +39,7 @@ public:
                bool isListener,
                bool isProvider,
                int stateType,
+               const StateOptions& stateOptions,
                ndn::Face& face,
                NotificationAPICallback notificationCB);
 
@@ -45,7 +45,20 @@ namespace notificationLib
       IBFEntry = 143,
       IBFTable = 143,
       ListEntry = 144,
-      ListTable = 145
+      ListTable = 145,
+      IBFHashType = 146,
+      ListDeltaTable = 147,
+      TupleTable = 148,
+      ProducerIndex = 149,
+      ListWatermarkTable = 150,
+      KeyBase = 151,
+      KeyResolution = 152,
+      BloomTable = 153,
+      BloomHashCount = 154,
+      BloomBits = 155,
+      RangeTable = 156,
+      SketchTable = 157,
+      RangeList = 158
     };
   }
   // namespace dataType
@@ -180,7 +193,7 @@ namespace notificationLib
       //   m_eventsList.push_back(name);
       // }
       void
-      set(std::unordered_map<uint64_t,std::vector<Name>>& notificationList)
+      set(const std::unordered_map<uint64_t,std::vector<Name>>& notificationList)
       {
         //m_eventsList.insert(m_eventsList.end(),nameList.begin(), nameList.begin());
         m_eventsListPerTimestamp = notificationList;
@@ -201,30 +214,75 @@ namespace notificationLib
       {
         return m_eventsListPerTimestamp;
       }
+      // TUPLE state: index of the producer that created timestamp
+      void
+      setProducer(uint64_t timestampKey, uint64_t producerIndex)
+      {
+        m_producerPerTimestamp[timestampKey] = producerIndex;
+      }
+      // 0 if unknown
+      uint64_t
+      getProducer(uint64_t timestampKey) const
+      {
+        auto it = m_producerPerTimestamp.find(timestampKey);
+        return it == m_producerPerTimestamp.end() ? 0 : it->second;
+      }
+      // RANGE state: the RangeList of sub-ranges the producer split, for
+      // the next interest (see State::getRangeRequest)
+      void
+      setRanges(const Block& ranges)
+      {
+        m_ranges = ranges;
+      }
+      // no wire if there are none
+      const Block&
+      getRanges() const
+      {
+        return m_ranges;
+      }
+      // an optional RangeList after the entries, older decoders skip it
+      template<encoding::Tag T>
+      static size_t
+      prependRanges(EncodingImpl<T>& encoder, const Block& ranges)
+      {
+        if (!ranges.hasWire())
+          return 0;
+        return encoder.prependByteArrayBlock(tlv::RangeList, ranges.value(), ranges.value_size());
+      }
+      // One EventEntry. Events may be any indexable sequence of Names
+      // (e.g. a history view), so entries can be encoded without
+      // copying the names into a NotificationEventsList first.
+      template<encoding::Tag T, typename Events>
+      static size_t
+      prependEventEntry(EncodingImpl<T>& encoder, uint64_t timestamp, uint64_t producer,
+                        const Events& events)
+      {
+        size_t entryLength = 0;
+
+        entryLength += prependNonNegativeIntegerBlock(encoder, tlv::Timestamp, timestamp);
+
+        // optional, older decoders skip it
+        if (producer != 0)
+          entryLength += prependNonNegativeIntegerBlock(encoder, tlv::ProducerIndex, producer);
+
+        // encode the list of events for timestamp
+        for (size_t i = events.size(); i > 0; --i)
+          entryLength += events[i - 1].wireEncode(encoder);
+
+        entryLength += encoder.prependVarNumber(entryLength);
+        entryLength += encoder.prependVarNumber(tlv::EventEntry);
+        return entryLength;
+      }
+
       //template<bool T>
       template<encoding::Tag T>
       size_t
       wireEncode(EncodingImpl<T>& encoder) const
       {
-        size_t totalLength = 0;
+        size_t totalLength = prependRanges(encoder, m_ranges);
         // go over the unordered_map
-        for (auto i: m_eventsListPerTimestamp)
-        {
-          size_t entryLength = 0;
-
-          entryLength += prependNonNegativeIntegerBlock(encoder, tlv::Timestamp, i.first);
-
-          // encode the list of events for timestamp
-          const std::vector<Name>& events = i.second;
-          for (std::vector<Name>::const_reverse_iterator iName = events.rbegin();
-               iName != events.rend(); ++iName)
-          {
-            entryLength += iName->wireEncode(encoder);
-          }
-          entryLength += encoder.prependVarNumber(entryLength);
-          entryLength += encoder.prependVarNumber(tlv::EventEntry);
-          totalLength += entryLength;
-        }
+        for (auto const& i: m_eventsListPerTimestamp)
+          totalLength += prependEventEntry(encoder, i.first, getProducer(i.first), i.second);
 
         totalLength += encoder.prependVarNumber(totalLength);
         totalLength += encoder.prependVarNumber(tlv::NotificationList);
@@ -259,6 +317,8 @@ namespace notificationLib
       wireDecode(const Block& wire)
       {
         m_eventsListPerTimestamp.clear();
+        m_producerPerTimestamp.clear();
+        m_ranges = Block();
 
         if (!wire.hasWire())
           std::cerr << "The supplied block does not contain wire format" << std::endl;
@@ -279,6 +339,7 @@ namespace notificationLib
             Block::element_const_iterator entryIt = it->elements_begin();
             std::vector<Name> events;
             uint64_t timestamp = 0;
+            uint64_t producer = 0;
 
             while(entryIt != it->elements_end())
             {
@@ -288,14 +349,22 @@ namespace notificationLib
               }
               else if (entryIt->type() == tlv::Timestamp)
                 timestamp = readNonNegativeInteger(*entryIt);
+              else if (entryIt->type() == tlv::ProducerIndex)
+                producer = readNonNegativeInteger(*entryIt);
 
               ++entryIt;
             }
             if(timestamp == 0 || events.empty())
               std::cerr << "Failed encoding  -  no timestamp or events in entry" <<std::endl;
             else
+            {
               m_eventsListPerTimestamp[timestamp] = events;
+              if (producer != 0)
+                m_producerPerTimestamp[timestamp] = producer;
+            }
           }
+          else if (it->type() == tlv::RangeList)
+            m_ranges = *it;
           else
           {
             std::cerr << "Unexpected TLV type when decoding reply: " +
@@ -307,6 +376,8 @@ namespace notificationLib
     private:
       // list of events per timestamp if this is of type EventList
       std::unordered_map<uint64_t,std::vector<Name>> m_eventsListPerTimestamp;
+      std::unordered_map<uint64_t,uint64_t> m_producerPerTimestamp;
+      Block m_ranges;
 
     }; // end class NotificationEventsList
 
@@ -315,7 +386,7 @@ namespace notificationLib
     {
       m_type = dataType::Unknown;
     };
-    NotificationData(std::unordered_map<uint64_t,std::vector<Name>>& notificationList)
+    NotificationData(const std::unordered_map<uint64_t,std::vector<Name>>& notificationList)
     {
       m_type = dataType::EventsContainer;
       m_eventsObj.set(notificationList);
@@ -378,7 +449,17 @@ namespace notificationLib
       else if (m_type == dataType::EventsContainer)
         totalLength = m_eventsObj.wireEncode(encoder);
 
-      totalLength += prependNonNegativeIntegerBlock(encoder, tlv::Type, m_type);
+      return prependReply(encoder, m_type, totalLength);
+    }
+
+    // wraps the events or data list of contentLength bytes, already
+    // prepended, into a NotificationDataReply
+    template<encoding::Tag T>
+    static size_t
+    prependReply(EncodingImpl<T>& encoder, dataType type, size_t contentLength)
+    {
+      size_t totalLength = contentLength;
+      totalLength += prependNonNegativeIntegerBlock(encoder, tlv::Type, type);
       totalLength += encoder.prependVarNumber(totalLength);
       totalLength += encoder.prependVarNumber(tlv::NotificationDataReply);
 
@@ -18,6 +18,7 @@
 #include "notificationManager.hpp"
 #include "logger.hpp"
 #include "api.hpp"
+#include "state-file.hpp"
 #include <ndn-cxx/util/backports.hpp>
 
 INIT_LOGGER(logicManager);
@@ -30,15 +31,33 @@ NotificationProtocol::NotificationProtocol(ndn::Face& face,
                                            const time::milliseconds& notificationMemoryFreshness,
                                            const time::milliseconds& notificationInterestLifetime,
                                            int listType,
+                                           const StateOptions& stateOptions,
                                            const NotificationAPICallback& onUpdate,
                                            const Name& defaultSigningId,
                                            std::shared_ptr<Validator> validator,
                                            const time::milliseconds& notificationReplyFreshness)
   : m_face(face)
   , m_notificationName(notificationName)
-  , m_state(maxNotificationMemory, listType)
+  , m_state(maxNotificationMemory, listType, stateOptions)
   , m_notificationMemoryFreshness(notificationMemoryFreshness)
   , m_onUpdate(onUpdate)
+  , m_stateHistoryBytes(0)
+  , m_stateHistoryEvictionCount(0)
+  , m_maxNotificationMemory(maxNotificationMemory)
+  , m_maxMemoryBytes(stateOptions.maxMemoryBytes)
+  , m_interestState(stateOptions.interestState)
+  , m_attachState(false)
+  , m_digestStateBytes(0)
+  , m_pushedVersion(0)
+  , m_diffWork(new boost::asio::io_service::work(m_diffService))
+  , m_snapshotFile(stateOptions.snapshotFile)
+  , m_snapshotInterval(stateOptions.snapshotInterval)
+  , m_savedVersion(0)
+  , m_snapshotWriting(false)
+  , m_logSyncInterval(stateOptions.walSyncInterval)
+  , m_logBatchSize(std::max<size_t>(stateOptions.walBatchSize, 1))
+  , m_logCommitting(false)
+  , m_lifetime(make_shared<int>(0))
   , m_interestTable(m_face.getIoService())
     //, m_outstandingInterestId(0)
   , m_scheduler(m_face.getIoService())
@@ -51,7 +70,35 @@ NotificationProtocol::NotificationProtocol(ndn::Face& face,
   , m_signingId(defaultSigningId)
   , m_validator(validator)
 {
+  m_diffWorker = std::thread([this] { m_diffService.run(); });
 
+  if (!m_snapshotFile.empty())
+  {
+    // a warm restart: consumers see the window we had, not an empty one
+    size_t restored = m_state.restore(m_snapshotFile, m_notificationMemoryFreshness);
+    _LOG_INFO("NotificationProtocol: restored " << restored << " notifications from "
+              << m_snapshotFile);
+    m_savedVersion = m_state.getVersion();
+    m_scheduler.schedule(m_snapshotInterval, bind(&NotificationProtocol::saveSnapshot, this));
+  }
+
+  if (!stateOptions.walDirectory.empty())
+  {
+    // a segment per memoryFreshness, so expired segments can go whole
+    m_log = ndn::make_unique<NotificationLog>(stateOptions.walDirectory,
+                                              getFreshnessInNanoSeconds());
+    // after the snapshot: what it holds is skipped
+    auto now_ns = boost::chrono::time_point_cast<boost::chrono::nanoseconds>(ndn::time::system_clock::now());
+    uint64_t now_ns_long_type = (now_ns.time_since_epoch()).count();
+    size_t replayed = m_log->replay([this, now_ns_long_type] (uint64_t timestamp,
+                                                              const std::vector<Name>& eventList) {
+      if (timestamp > now_ns_long_type ||
+          !State::isExpired(now_ns_long_type, timestamp, m_notificationMemoryFreshness))
+        m_state.addLocal(timestamp, eventList);
+    });
+    _LOG_INFO("NotificationProtocol: replayed " << replayed << " logged notifications from "
+              << stateOptions.walDirectory);
+  }
 }
 
 NotificationProtocol::~NotificationProtocol()
@@ -65,6 +112,92 @@ NotificationProtocol::~NotificationProtocol()
   m_face.shutdown();
   m_scheduler.cancelAllEvents();
   m_interestTable.clear();
+
+  // diffs still queued are dropped, their consumers ask again
+  m_diffWork.reset();
+  m_diffService.stop();
+  if (m_diffWorker.joinable())
+    m_diffWorker.join();
+
+  if (m_logWriter.joinable())
+    m_logWriter.join();
+  if (m_log && !m_logBatch.empty())
+    m_log->commit(m_logBatch);
+
+  if (m_snapshotWriter.joinable())
+    m_snapshotWriter.join();
+  // the last changes too, so a clean restart loses nothing
+  if (!m_snapshotFile.empty() && m_state.getVersion() != m_savedVersion)
+    StateFile::write(m_snapshotFile, *m_state.saveImage());
+}
+
+void
+NotificationProtocol::saveSnapshot()
+{
+  m_scheduler.schedule(m_snapshotInterval, bind(&NotificationProtocol::saveSnapshot, this));
+
+  // still writing the previous one (a slow disk), or nothing to save
+  if (m_snapshotWriting || m_state.getVersion() == m_savedVersion)
+    return;
+  if (m_snapshotWriter.joinable())
+    m_snapshotWriter.join();
+
+  // building the image is a copy of the state, the write and fsync are
+  // what takes time
+  ConstBufferPtr image = m_state.saveImage();
+  m_savedVersion = m_state.getVersion();
+  m_snapshotWriting = true;
+  std::string path = m_snapshotFile;
+  m_snapshotWriter = std::thread([this, path, image] {
+    if (!StateFile::write(path, *image))
+      _LOG_ERROR("NotificationProtocol::saveSnapshot: cannot save the state to " << path);
+    m_snapshotWriting = false;
+  });
+}
+
+void
+NotificationProtocol::commitLog()
+{
+  m_logCommitEvent.cancel();
+  if (m_logCommitting || m_logBatchNotifications.empty())
+    return;
+  if (m_logWriter.joinable())
+    m_logWriter.join();
+
+  // the batch is the group commit: one write and one fsync for all of it
+  auto batch = make_shared<std::vector<uint8_t>>();
+  auto notifications = make_shared<std::vector<std::pair<uint64_t, std::vector<Name>>>>();
+  batch->swap(m_logBatch);
+  notifications->swap(m_logBatchNotifications);
+  m_logCommitting = true;
+  NotificationLog* log = m_log.get();
+  boost::asio::io_service& ioService = m_face.getIoService();
+  std::weak_ptr<int> lifetime = m_lifetime;
+  m_logWriter = std::thread([this, log, batch, notifications, &ioService, lifetime] {
+    bool isSynced = log->commit(*batch);
+    ioService.post([this, notifications, isSynced, lifetime] {
+      if (!lifetime.expired())
+        onLogCommitted(*notifications, isSynced);
+    });
+  });
+}
+
+void
+NotificationProtocol::onLogCommitted(const std::vector<std::pair<uint64_t, std::vector<Name>>>& notifications,
+                                     bool isSynced)
+{
+  m_logCommitting = false;
+  // holding them back for good would lose them for sure
+  if (!isSynced)
+    _LOG_ERROR("NotificationProtocol::onLogCommitted: " << notifications.size()
+               << " notifications are pushed without being logged");
+  for (auto const& notification: notifications)
+    m_state.addLocal(notification.first, notification.second);
+  pushToPendingInterests();
+
+  // what came in during the sync goes now
+  if (!m_logBatchNotifications.empty())
+    commitLog();
 }
 
 void
@@ -78,10 +211,39 @@ NotificationProtocol::sendNotificationInterest()
   m_state.cleanup(m_notificationMemoryFreshness);
 
   ConstBufferPtr state  = m_state.getState();
-  interestName.append(state->get<uint8_t>(), state->size());
+  bool isRangeRequest = m_rangeRequest != nullptr;
+  if (isRangeRequest)
+  {
+    state = m_rangeRequest;
+    m_rangeRequest.reset();
+  }
+  if (m_interestState == InterestState::DIGEST)
+  {
+    // peers in sync with us send the same digest; a range request is
+    // new to the producer, it goes along
+    ConstBufferPtr digest = m_state.getStateDigest();
+    if (isRangeRequest)
+    {
+      ConstBufferPtr encoded = StateCodec::decompress(state->data(), state->size());
+      digest = ndn::util::Sha256::computeDigest(encoded->data(), encoded->size());
+      m_attachState = true;
+    }
+    interestName.append(digest->get<uint8_t>(), digest->size());
+    rememberState(std::string(digest->begin(), digest->end()), state);
+  }
+  else
+    interestName.append(state->get<uint8_t>(), state->size());
   //interestName.appendVersion();
-  m_outstandingInterestName = interestName;
   m_stateHistory.push_back(state);
+  m_stateHistoryBytes += state->size();
+  while (m_stateHistory.size() > std::max<size_t>(m_maxNotificationMemory, 1) ||
+         (m_maxMemoryBytes != 0 && m_stateHistoryBytes > m_maxMemoryBytes &&
+          m_stateHistory.size() > 1))
+  {
+    m_stateHistoryBytes -= m_stateHistory.front()->size();
+    m_stateHistory.pop_front();
+    m_stateHistoryEvictionCount++;
+  }
 
   // scheduling the next interest so there is always a
   // long-lived interest packet in the PIT
@@ -97,6 +259,13 @@ NotificationProtocol::sendNotificationInterest()
   m_scheduledInterestId = eventId;
 
   Interest interest(interestName);
+  if (m_attachState)
+  {
+    // the name gets a digest of the parameters, so it is read back below
+    interest.setApplicationParameters(state->get<uint8_t>(), state->size());
+    m_attachState = false;
+  }
+  m_outstandingInterestName = interest.getName();
   api::collectNameSize(1,interestName.toUri().size());
   interest.setMustBeFresh(true);
   interest.setInterestLifetime(m_notificationInterestLifetime);
@@ -122,6 +291,16 @@ NotificationProtocol::onNotificationData(const Interest& interest,
 
   // TBD: validate data
 
+  if (data.getContentType() == tlv::ContentType_Nack)
+  {
+    // the producer does not know our state digest
+    _LOG_DEBUG("NotificationProtocol::onNotificationData: state requested, resending interest");
+    m_attachState = true;
+    if (m_outstandingInterestName == interest.getName())
+      resetOutstandingInterest();
+    return;
+  }
+
   // Remove satisfied interest from PIT
   //m_interestTable.erase(interest.getName());
 
@@ -151,6 +330,16 @@ NotificationProtocol::onNotificationData(const Interest& interest,
   // reconcile differences
   m_state.reconcile(newStateComponentBuf, notificationData, m_notificationMemoryFreshness);
 
+  // RANGE: the ranges the producer split whose fingerprints differ from
+  // ours are compared in the next round, right away
+  const Block& ranges = notificationData.m_eventsObj.getRanges();
+  if (ranges.hasWire())
+  {
+    m_rangeRequest = m_state.getRangeRequest(ranges);
+    if (m_rangeRequest != nullptr && m_outstandingInterestName == interest.getName())
+      resetOutstandingInterest();
+  }
+
   ConstBufferPtr localStateNameAfterReconcile = m_state.getState();
 
   // if no updates
@@ -205,27 +394,46 @@ NotificationProtocol::onNotificationInterest(const Name& name, const Interest& i
   _LOG_DEBUG("NotificationProtocol::onNotificationInterest: "
              << interest);
 
-  ConstBufferPtr interestState = make_shared<ndn::Buffer>(interest.getName().get(-1).value(),
-                                                          interest.getName().get(-1).value_size());
-
-  ConstBufferPtr localState = m_state.getState();
-
-  int nPushedItems = 0;
-  if(*interestState != *localState)
+  if (m_interestState == InterestState::DIGEST)
   {
-    // if data is ready then push it now.
-    nPushedItems = sendDiff(interest.getName());
+    Name stateName = interest.getName();
+    if (stateName.size() > 0 && stateName.get(-1).isParametersSha256Digest())
+      stateName = stateName.getPrefix(-1);
+    std::string digest(stateName.get(-1).value(),
+                       stateName.get(-1).value() + stateName.get(-1).value_size());
+
+    if (interest.hasApplicationParameters())
+    {
+      // only a state that hashes to the digest, a wrong one would be
+      // used for every consumer sending that digest
+      Block parameters = interest.getApplicationParameters();
+      ConstBufferPtr encoded = StateCodec::decompress(parameters.value(), parameters.value_size());
+      if (encoded != nullptr &&
+          *ndn::util::Sha256::computeDigest(encoded->data(), encoded->size()) ==
+          ndn::Buffer(digest.begin(), digest.end()))
+        rememberState(digest, make_shared<ndn::Buffer>(parameters.value(), parameters.value_size()));
+      else
+        _LOG_ERROR("NotificationProtocol::onNotificationInterest: state in "
+                   << interest.getName() << " does not match its digest");
+    }
+    else
+    {
+      ConstBufferPtr localDigest = m_state.getStateDigest();
+      if (digest == std::string(localDigest->begin(), localDigest->end()))
+        rememberState(digest, m_state.getState());
+    }
   }
-  if(*interestState == *localState || nPushedItems == 0)
+
+  ConstBufferPtr interestState = getRemoteState(interest.getName());
+  if (interestState == nullptr)
   {
-    //same state or different state, but nothing was pushed.
-    // This can happen if received interest contains old timestamps
-    // ==> save interest in interest table for future processing
-    // Insert full name Interest with notification name
-    _LOG_DEBUG("NotificationProtocol::onNotificationInterest: "
-               << "no items to push, saving Interest ");
-    m_interestTable.insert(interest, name);
+    sendStateNack(interest.getName());
+    return;
   }
+
+  // if data is ready it is pushed once the diff is built, otherwise the
+  // interest is saved in the interest table for future processing
+  sendDiff(interest, name, true);
 }
 
 void
@@ -242,15 +450,38 @@ NotificationProtocol::satisfyPendingNotificationInterests(const std::vector<Name
      _LOG_INFO("NotificationProtocol::satisfyPendingNotificationInterests: Notification List is empty, stopping.");
      return;
   }
+  if (m_log)
+  {
+    // added to the state once it is on disk, see onLogCommitted: a
+    // consumer must not see its key in our state before that
+    uint64_t newTimestampKey = m_state.reserveKey();
+    _LOG_INFO("NotificationProtocol::satisfyPendingNotificationInterests: new timestamp key "
+              << newTimestampKey << " to log");
+    NotificationLog::encode(m_logBatch, newTimestampKey, eventList);
+    m_logBatchNotifications.push_back(std::make_pair(newTimestampKey, eventList));
+    if (m_logBatchNotifications.size() >= m_logBatchSize)
+      commitLog();
+    else if (m_logBatchNotifications.size() == 1)
+      m_logCommitEvent = m_scheduler.schedule(m_logSyncInterval,
+                                              bind(&NotificationProtocol::commitLog, this));
+    return;
+  }
+
   // first, create new key timestamp for the pushed events
   uint64_t newTimestampKey = m_state.createKey(eventList);
 
   _LOG_INFO("NotificationProtocol::satisfyPendingNotificationInterests: new timestamp key" << newTimestampKey);
 
+  pushToPendingInterests();
+}
+
+void
+NotificationProtocol::pushToPendingInterests()
+{
   try {
     if(m_interestTable.begin() == m_interestTable.end())
     {
-      _LOG_INFO("NotificationProtocol::satisfyPendingNotificationInterests: InterestTable is empty. Can't push data");
+      _LOG_INFO("NotificationProtocol::pushToPendingInterests: InterestTable is empty. Can't push data");
     }
     // Go over all recorded requests and compute the set-difference
     // if can respond, reply with missing data
@@ -258,7 +489,14 @@ NotificationProtocol::satisfyPendingNotificationInterests(const std::vector<Name
     while (it != m_interestTable.end()) {
       ConstUnsatisfiedInterestPtr request = *it;
       ++it;
-      int nPushedItems = sendDiff(request->interest.getName());
+      // the digest may have been dropped since the interest was parked:
+      // have the consumer resend its state rather than leave it waiting
+      if (getRemoteState(request->interest.getName()) == nullptr)
+      {
+        sendStateNack(request->interest.getName());
+        continue;
+      }
+      sendDiff(request->interest, Name(), false);
     }
     m_interestTable.clear();
   }
@@ -266,101 +504,170 @@ NotificationProtocol::satisfyPendingNotificationInterests(const std::vector<Name
     // ok. not really an error
   }
 }
-int
-NotificationProtocol::sendDiff(const Name& interestName,  const ndn::time::milliseconds freshness /*= ndn::time::milliseconds(-1));*/)
+void
+NotificationProtocol::sendDiff(const Interest& interest, const Name& filterName, bool park)
 {
   _LOG_DEBUG("NotificationProtocol::sendDiff: Start");
-  std::set<std::pair<uint64_t,std::vector<uint8_t> > > inLocal, inRemote;
 
-  auto now_ns = boost::chrono::time_point_cast<boost::chrono::nanoseconds>(ndn::time::system_clock::now());
-  auto now_ns_long_type = (now_ns.time_since_epoch()).count();
+  // get request state
+  ConstBufferPtr rmtStatus = getRemoteState(interest.getName());
+  if (rmtStatus == nullptr)
+  {
+    _LOG_DEBUG("NotificationProtocol::sendDiff: unknown state digest");
+    return;
+  }
 
-//  ndn::time::milliseconds longestFreshness = freshness;
+  // consumers in sync send the same state: reply to all of them with
+  // the content built for the first while our state is unchanged
+  std::string remoteKey(rmtStatus->begin(), rmtStatus->end());
+  if (m_pushedVersion != m_state.getVersion())
+  {
+    m_pushedContent.clear();
+    m_pushedVersion = m_state.getVersion();
+  }
+  auto pushed = m_pushedContent.find(remoteKey);
+  if (pushed != m_pushedContent.end())
+  {
+    _LOG_DEBUG("NotificationProtocol::sendDiff: reusing content for known state");
+    replyWithDiff(DiffRequest{interest, filterName, park}, pushed->second);
+    return;
+  }
 
-  // get new status name component
+  // or with the content being built for the first
+  auto inFlight = m_diffsInFlight.find(remoteKey);
+  if (inFlight != m_diffsInFlight.end())
+  {
+    inFlight->second.push_back(DiffRequest{interest, filterName, park});
+    return;
+  }
+  m_diffsInFlight[remoteKey].push_back(DiffRequest{interest, filterName, park});
+
+  // decoding, the set-difference, encoding and compression take the
+  // time, they run on a snapshot of the state off the io thread
+  std::shared_ptr<const StateSnapshot> snapshot = m_state.snapshot();
+  time::milliseconds freshness = m_notificationMemoryFreshness;
+  boost::asio::io_service& ioService = m_face.getIoService();
+  std::weak_ptr<int> lifetime = m_lifetime;
+  m_diffService.post([this, snapshot, rmtStatus, remoteKey, freshness, &ioService, lifetime] {
+    auto diff = make_shared<Diff>(buildDiff(*snapshot, rmtStatus, freshness));
+    ioService.post([this, remoteKey, diff, lifetime] {
+      if (!lifetime.expired())
+        onDiffBuilt(remoteKey, *diff);
+    });
+  });
+}
 
-  ConstBufferPtr myStatus = m_state.getState();
+NotificationProtocol::Diff
+NotificationProtocol::buildDiff(const StateSnapshot& snapshot, ConstBufferPtr remoteState,
+                                time::milliseconds freshness)
+{
+  Diff diff;
+  diff.version = snapshot.getVersion();
+  diff.state = snapshot.getState();
+  diff.count = 0;
+  diff.hasRanges = false;
+
+  // compute the set-difference; RANGE ranges too large to push come
+  // back split, for the peer to compare
+  std::set<std::pair<uint64_t,std::vector<uint8_t> > > inLocal, inRemote;
+  Block subRanges;
+  if (*diff.state == *remoteState ||
+      !snapshot.getDiff(remoteState, inLocal, inRemote, subRanges))
+    return diff;
+  _LOG_DEBUG("NotificationProtocol::buildDiff: list size in local is:" << inLocal.size());
 
-  Name fullDataName(interestName);
-  // get request state
-  ConstBufferPtr rmtStatus = make_shared<ndn::Buffer>(interestName.get(-1).value(),
-                                                      interestName.get(-1).value_size());
+  auto now_ns = boost::chrono::time_point_cast<boost::chrono::nanoseconds>(ndn::time::system_clock::now());
+  uint64_t now_ns_long_type = (now_ns.time_since_epoch()).count();
 
-  fullDataName.append(myStatus->get<uint8_t>(),myStatus->size());
+  // timestamps only, the events are encoded from the history as is;
+  // send all new data (ignore removals for now. TBD)
+  std::vector<uint64_t> listToPush;
+  for (auto const& lit: inLocal)
+  {
+    // a timestamp ahead of our clock (a peer's, within the skew we
+    // accept) has not expired
+    if (lit.first <= now_ns_long_type &&
+        State::isExpired(now_ns_long_type, lit.first, freshness))
+      diff.expired.push_back(lit.first);
+    else if (!snapshot.getEventsViewAtTimestamp(lit.first).empty())
+      listToPush.push_back(lit.first);
+  }
+  diff.hasRanges = subRanges.hasWire();
+  if (!listToPush.empty() || diff.hasRanges)
+    diff.content = snapshot.encodeEvents(listToPush, subRanges);
+  diff.count = listToPush.size();
+  return diff;
+}
 
-  // compute the set-difference
-  if (m_state.getDiff(rmtStatus, inLocal, inRemote))
+void
+NotificationProtocol::onDiffBuilt(const std::string& remoteState, const Diff& diff)
+{
+  std::vector<DiffRequest> requests;
+  auto inFlight = m_diffsInFlight.find(remoteState);
+  if (inFlight != m_diffsInFlight.end())
   {
-    _LOG_DEBUG("NotificationProtocol::sendDiff: list size in local is:" << inLocal.size());
+    requests.swap(inFlight->second);
+    m_diffsInFlight.erase(inFlight);
+  }
 
-    std::unordered_map<uint64_t,std::vector<Name>> listToPush;
-    // send all new data (ignore removals for now. TBD)
-    for(auto const& lit: inLocal)
-    {
-      // how long past
-      // auto tPasses = now_ns_long_type - lit.first;
-      // ndn::time::milliseconds timestampInMs(lit.first);
-      //
-      // // if still relevant (convert ms to ns)
-      if(!State::isExpired(now_ns_long_type, lit.first, m_notificationMemoryFreshness))
-      {
-        std::vector<Name>& eventList = m_state.getEventsAtTimestamp(lit.first);
+  // expired - remove from state
+  for (uint64_t timestamp: diff.expired)
+    m_state.erase(timestamp);
 
-        if(!eventList.empty())
-          listToPush[lit.first] = eventList;
-      }
-      else // expired - remove from state
-      {
-        m_state.erase(lit.first);
-      }
-    }
-    bool sent = false;
-    // if remote is not empty and has unexpired info - trigger interest now to get it.
-    _LOG_DEBUG("NotificationProtocol::sendDiff: list size in remote is:" << inRemote.size());
-    for(auto const& rit: inRemote)
+  // the next consumers with this state get the same, while it is ours
+  if (diff.version == m_state.getVersion())
+  {
+    if (m_pushedVersion != diff.version)
     {
-      if (sent)
-        break;
-      // // if still relevant (convert ms to ns)
-      if(!State::isExpired(now_ns_long_type, rit.first, m_notificationMemoryFreshness))
-      {
-          // enough that one is not expire to trigget an interest
-          //can leave the loop now
-          // TBD_hila: send interest and mark sent as true
-      }
-
+      m_pushedContent.clear();
+      m_pushedVersion = diff.version;
     }
+    if (m_pushedContent.size() >= std::max<size_t>(m_maxNotificationMemory, 1))
+      m_pushedContent.clear();
+    m_pushedContent[remoteState] = diff;
+  }
 
-    if(!listToPush.empty())
+  for (auto const& request: requests)
+    replyWithDiff(request, diff);
+}
+
+void
+NotificationProtocol::replyWithDiff(const DiffRequest& request, const Diff& diff)
+{
+  if (diff.count > 0 || diff.hasRanges)
+  {
+    Name fullDataName(request.interest.getName());
+    fullDataName.append(diff.state->get<uint8_t>(), diff.state->size());
+    pushNotificationData(fullDataName, diff.content, m_notificationMemoryFreshness);
+  }
+  else if (request.park)
+  {
+    // a notification added while the diff was built may be the one the
+    // consumer lacks: diff again rather than wait for the next
+    if (diff.version != m_state.getVersion())
     {
-      if (freshness > ndn::time::milliseconds(0))
-        pushNotificationData(fullDataName, listToPush, freshness);
-      else
-        pushNotificationData(fullDataName, listToPush, m_notificationMemoryFreshness);
+      sendDiff(request.interest, request.filterName, true);
+      return;
     }
-
-      return (listToPush.size());
+    //same state or different state, but nothing was pushed.
+    // This can happen if received interest contains old timestamps
+    // ==> save interest in interest table for future processing
+    _LOG_DEBUG("NotificationProtocol::replyWithDiff: "
+               << "no items to push, saving Interest ");
+    m_interestTable.insert(request.interest, request.filterName);
   }
-  return 0;
 }
+
 void
 NotificationProtocol::pushNotificationData(const Name& dataName,
-                                          std::unordered_map<uint64_t,std::vector<Name>>& notificationList,
-                                          const ndn::time::milliseconds& freshness)
+                                           const Block& content,
+                                           const ndn::time::milliseconds& freshness)
 {
   _LOG_DEBUG("NotificationProtocol::pushNotificationData named: " << dataName );
 
-  NotificationData eventListData(notificationList);
-  eventListData.setType(NotificationData::dataType::EventsContainer);
-
-  // for(int i = 0; i < eventList.size(); ++i)
-  // {
-  //   _LOG_INFO("NotificationProtocol::pushNotificationData: Adding event" << eventList[i]);
-  //   eventListData.addEvent(eventList[i]);
-  // }
   shared_ptr<Data> data = make_shared<Data>();
 
-  data->setContent(eventListData.wireEncode());
+  data->setContent(content);
   //data->setFinalBlockId(dataName.get(-1));
   data->setFreshnessPeriod(freshness);
   data->setName(dataName);
@@ -459,6 +766,66 @@ NotificationProtocol::pushNotificationData(const Name& dataName,
 //     resetOutstandingInterest(interestName);
 //   }
 // }
+ConstBufferPtr
+NotificationProtocol::getRemoteState(const Name& interestName) const
+{
+  // interests with ApplicationParameters end with their digest
+  size_t stateIndex = interestName.size() - 1;
+  if (interestName.get(stateIndex).isParametersSha256Digest())
+    stateIndex--;
+  const Name::Component& component = interestName.get(stateIndex);
+
+  if (m_interestState != InterestState::DIGEST)
+    return make_shared<ndn::Buffer>(component.value(), component.value_size());
+
+  auto it = m_digestStates.find(std::string(component.value(),
+                                            component.value() + component.value_size()));
+  if (it == m_digestStates.end())
+    return nullptr;
+  return it->second;
+}
+
+void
+NotificationProtocol::rememberState(const std::string& digest, ConstBufferPtr state)
+{
+  auto it = m_digestStates.find(digest);
+  if (it != m_digestStates.end())
+    return;
+
+  m_digestStates[digest] = state;
+  m_digestOrder.push_back(digest);
+  m_digestStateBytes += state->size();
+  while (m_digestOrder.size() > std::max<size_t>(m_maxNotificationMemory, 1))
+  {
+    auto oldest = m_digestStates.find(m_digestOrder.front());
+    m_digestStateBytes -= oldest->second->size();
+    m_digestStates.erase(oldest);
+    m_digestOrder.pop_front();
+  }
+}
+
+void
+NotificationProtocol::sendStateNack(const Name& interestName)
+{
+  _LOG_DEBUG("NotificationProtocol::sendStateNack: unknown state digest in " << interestName);
+
+  // application nack, named like a reply so it satisfies the interest
+  ConstBufferPtr localState = m_state.getState();
+  Name dataName(interestName);
+  dataName.append(localState->get<uint8_t>(), localState->size());
+
+  shared_ptr<Data> data = make_shared<Data>();
+  data->setName(dataName);
+  data->setContentType(tlv::ContentType_Nack);
+
+  if (m_signingId.empty())
+    m_keyChain.sign(*data);
+  else
+    m_keyChain.sign(*data, security::signingByIdentity(m_signingId));
+
+  m_face.put(*data);
+}
+
 void
 NotificationProtocol::resetOutstandingInterest()
 {
@@ -20,9 +20,11 @@
 
 #include "common.hpp"
 #include "interest-table.hpp"
+#include "notification-log.hpp"
 #include "notificationData.hpp"
 #include "state.hpp"
 //#include <boost/random.hpp>
+#include <boost/asio/io_service.hpp>
 #include <random>
 
 #include <boost/archive/iterators/dataflow_exception.hpp>
@@ -31,8 +33,11 @@
 #include <boost/iterator/transform_iterator.hpp>
 #include <boost/throw_exception.hpp>
 
+#include <atomic>
+#include <deque>
 #include <memory>
 #include <random>
+#include <thread>
 #include <unordered_map>
 
 
@@ -59,6 +64,7 @@ namespace notificationLib
                          const time::milliseconds& notificationMemoryFreshness,
                          const time::milliseconds& eventInterestLifetime,
                          int listType,
+                         const StateOptions& stateOptions,
                          //const Name& notificationPrefix,
                          const NotificationAPICallback& onUpdate,
                          const Name& defaultSigningId,
@@ -87,6 +93,28 @@ namespace notificationLib
       return m_notificationMemoryFreshness.count()*1000000;
     }
 
+    // bytes held for this notification: event history and sent or
+    // digested states
+    size_t
+    getBytesUsed() const
+    {
+      return m_state.getBytesUsed() + m_stateHistoryBytes + m_digestStateBytes;
+    }
+
+    // notifications evicted from the state to stay within maxMemoryBytes
+    uint64_t
+    getEvictionCount() const
+    {
+      return m_state.getEvictionCount();
+    }
+
+    // sent states dropped from m_stateHistory
+    uint64_t
+    getStateHistoryEvictionCount() const
+    {
+      return m_stateHistoryEvictionCount;
+    }
+
   private:
     void
     onNotificationInterest(const Name& name, const Interest& interest);
@@ -114,14 +142,50 @@ namespace notificationLib
     // pushNotificationData(const Name& dataName,
     //                      const std::vector<Name>& eventList,
     //                      const ndn::time::milliseconds& freshness);
-    int
-    sendDiff(const Name& interestName,
-             const ndn::time::milliseconds freshness = ndn::time::milliseconds(-1));
+    // what sendDiff pushes for a remote state: the notifications we have
+    // and it lacks, encoded, and our state the data is named with
+    struct Diff
+    {
+      uint64_t version;
+      ConstBufferPtr state;
+      Block content;
+      int count;
+      // RANGE: content also holds ranges for the peer's next round
+      bool hasRanges;
+      // expired notifications found on the way, erased on the io thread
+      std::vector<uint64_t> expired;
+    };
+
+    // an interest waiting for the diff against its state; if park, it is
+    // saved in m_interestTable when there is nothing to push
+    struct DiffRequest
+    {
+      Interest interest;
+      Name filterName;
+      bool park;
+    };
+
+    // the diff against the state of interest is built from a snapshot on
+    // m_diffWorker, then pushed by onDiffBuilt
+    void
+    sendDiff(const Interest& interest, const Name& filterName, bool park);
+
+    // runs on m_diffWorker
+    static Diff
+    buildDiff(const StateSnapshot& snapshot, ConstBufferPtr remoteState,
+              time::milliseconds freshness);
 
+    void
+    onDiffBuilt(const std::string& remoteState, const Diff& diff);
+
+    void
+    replyWithDiff(const DiffRequest& request, const Diff& diff);
+
+    // content is an encoded NotificationData, see State::encodeEvents
     void
     pushNotificationData(const Name& dataName,
-                          std::unordered_map<uint64_t,std::vector<Name>>& notificationList,
-                          const ndn::time::milliseconds& freshness);
+                         const Block& content,
+                         const ndn::time::milliseconds& freshness);
     // void
     // pushNotificationData(const Name& dataName,
     //                      std::set<std::pair<uint64_t,std::vector<uint8_t> > >& list,
@@ -136,6 +200,38 @@ namespace notificationLib
      void
      resetOutstandingInterest();
 
+    // the state a notification interest names, nullptr if it names a
+    // digest we have not seen the state of
+    ConstBufferPtr
+    getRemoteState(const Name& interestName) const;
+
+    // DIGEST: remember which state a digest stands for
+    void
+    rememberState(const std::string& digest, ConstBufferPtr state);
+
+    // DIGEST: tells the sender of interestName to resend it with its state
+    void
+    sendStateNack(const Name& interestName);
+
+    // snapshotFile: saves the state if it changed, then reschedules
+    void
+    saveSnapshot();
+
+    // the pending interests get what they miss, then are dropped
+    void
+    pushToPendingInterests();
+
+    // walDirectory: hands the batch to m_logWriter, or leaves it for
+    // onLogCommitted if a commit is in flight
+    void
+    commitLog();
+
+    // walDirectory: the notifications are on disk (or the log failed),
+    // add them to the state and push them
+    void
+    onLogCommitted(const std::vector<std::pair<uint64_t, std::vector<Name>>>& notifications,
+                   bool isSynced);
+
   public:
     /*
     static const ndn::Name DEFAULT_NAME;
@@ -159,7 +255,59 @@ namespace notificationLib
     ndn::PendingInterestHandle m_outstandingInterestId;
     //const ndn::PendingInterestId* m_outstandingInterestId;
     NotificationAPICallback m_onUpdate;
-    std::vector<ConstBufferPtr> m_stateHistory;
+    // states we sent, newest last; at most maxNotificationMemory of
+    // them and within maxMemoryBytes if set
+    std::deque<ConstBufferPtr> m_stateHistory;
+    size_t m_stateHistoryBytes;
+    uint64_t m_stateHistoryEvictionCount;
+    size_t m_maxNotificationMemory;
+    size_t m_maxMemoryBytes;
+    // InterestState::*
+    int m_interestState;
+    // DIGEST: the next interest carries our state in ApplicationParameters
+    bool m_attachState;
+    // RANGE: sent by the next interest in place of our state, the ranges
+    // a producer split whose fingerprints differ from ours
+    ConstBufferPtr m_rangeRequest;
+    // DIGEST: states by digest, ours and the ones peers sent, at most
+    // maxNotificationMemory of them (oldest first in m_digestOrder)
+    std::unordered_map<std::string, ConstBufferPtr> m_digestStates;
+    std::deque<std::string> m_digestOrder;
+    size_t m_digestStateBytes;
+    // what sendDiff pushed per remote state at state version
+    // m_pushedVersion
+    uint64_t m_pushedVersion;
+    std::unordered_map<std::string, Diff> m_pushedContent;
+    // interests per remote state whose diff m_diffWorker is building
+    std::unordered_map<std::string, std::vector<DiffRequest>> m_diffsInFlight;
+    boost::asio::io_service m_diffService;
+    std::unique_ptr<boost::asio::io_service::work> m_diffWork;
+    std::thread m_diffWorker;
+    // snapshotFile: the image is built on the io thread and written on
+    // m_snapshotWriter, one file at a time; m_savedVersion is the state
+    // version last saved
+    std::string m_snapshotFile;
+    time::milliseconds m_snapshotInterval;
+    uint64_t m_savedVersion;
+    std::thread m_snapshotWriter;
+    std::atomic<bool> m_snapshotWriting;
+    // walDirectory: a notification only joins the state (and so the
+    // state we advertise) once m_log has synced it. Records wait in
+    // m_logBatch, their notifications in m_logBatchNotifications, for
+    // walSyncInterval or a full batch, then one batch at a time is
+    // written and synced on m_logWriter; what arrives meanwhile is the
+    // next batch.
+    std::unique_ptr<NotificationLog> m_log;
+    time::milliseconds m_logSyncInterval;
+    size_t m_logBatchSize;
+    std::vector<uint8_t> m_logBatch;
+    std::vector<std::pair<uint64_t, std::vector<Name>>> m_logBatchNotifications;
+    ndn::scheduler::EventId m_logCommitEvent;
+    std::thread m_logWriter;
+    bool m_logCommitting;
+    // handlers posted from other threads hold it weakly, they are
+    // dropped if we are gone
+    std::shared_ptr<int> m_lifetime;
 
     // Timer
     time::milliseconds m_notificationInterestLifetime;
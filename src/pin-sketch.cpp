@@ -0,0 +1,484 @@
+/* -*- Mode:C++; c-file-style:"bsd"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright 2020 Washington University in St. Louis
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pin-sketch.hpp"
+#include "notificationData.hpp"
+
+#include <algorithm>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define NOTIFICATIONLIB_X86_CLMUL
+#endif
+
+namespace notificationLib {
+
+// GF(2^64) modulo x^64 + x^4 + x^3 + x + 1; addition is xor
+
+// (hi, lo) is a product of degree < 127, folded with x^64 = x^4 + x^3 + x + 1
+static inline uint64_t
+gfReduce(uint64_t hi, uint64_t lo)
+{
+  // the bits hi * (x^4 + x^3 + x) pushes past x^63, degree < 4
+  uint64_t over = (hi >> 60) ^ (hi >> 61) ^ (hi >> 63);
+  lo ^= hi ^ (hi << 1) ^ (hi << 3) ^ (hi << 4);
+  return lo ^ over ^ (over << 1) ^ (over << 3) ^ (over << 4);
+}
+
+// carry-less a * b, 4 bits of b at a time
+static inline uint64_t
+gfMulPortable(uint64_t a, uint64_t b)
+{
+  // a times every 4-bit polynomial, up to 67 bits
+  uint64_t tableLo[16], tableHi[16];
+  tableLo[0] = tableHi[0] = 0;
+  tableLo[1] = a;
+  tableHi[1] = 0;
+  for (int i = 2; i < 16; i += 2)
+  {
+    tableLo[i] = tableLo[i / 2] << 1;
+    tableHi[i] = (tableHi[i / 2] << 1) | (tableLo[i / 2] >> 63);
+    tableLo[i + 1] = tableLo[i] ^ a;
+    tableHi[i + 1] = tableHi[i];
+  }
+
+  uint64_t hi = 0, lo = 0;
+  for (int shift = 60; shift >= 0; shift -= 4)
+  {
+    hi = (hi << 4) | (lo >> 60);
+    lo <<= 4;
+    unsigned nibble = (b >> shift) & 15;
+    lo ^= tableLo[nibble];
+    hi ^= tableHi[nibble];
+  }
+  return gfReduce(hi, lo);
+}
+
+#ifdef NOTIFICATIONLIB_X86_CLMUL
+__attribute__((target("pclmul,sse2")))
+static uint64_t
+gfMulClmul(uint64_t a, uint64_t b)
+{
+  __m128i product = _mm_clmulepi64_si128(_mm_cvtsi64_si128(a), _mm_cvtsi64_si128(b), 0);
+  uint64_t lo = _mm_cvtsi128_si64(product);
+  uint64_t hi = _mm_cvtsi128_si64(_mm_srli_si128(product, 8));
+  return gfReduce(hi, lo);
+}
+
+// dst[i] += scalar * src[i], the inner loop of the polynomial arithmetic
+__attribute__((target("pclmul,sse2")))
+static void
+gfMulAddClmul(uint64_t* dst, const uint64_t* src, size_t n, uint64_t scalar)
+{
+  __m128i factor = _mm_cvtsi64_si128(scalar);
+  for (size_t i = 0; i < n; i++)
+  {
+    __m128i product = _mm_clmulepi64_si128(factor, _mm_cvtsi64_si128(src[i]), 0);
+    dst[i] ^= gfReduce(_mm_cvtsi128_si64(_mm_srli_si128(product, 8)),
+                       _mm_cvtsi128_si64(product));
+  }
+}
+
+static bool
+detectClmul()
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("pclmul");
+}
+
+static const bool s_hasClmul = detectClmul();
+static bool s_useClmul = s_hasClmul;
+#endif
+
+static inline uint64_t
+gfMul(uint64_t a, uint64_t b)
+{
+#ifdef NOTIFICATIONLIB_X86_CLMUL
+  if (s_useClmul)
+    return gfMulClmul(a, b);
+#endif
+  return gfMulPortable(a, b);
+}
+
+static inline void
+gfMulAdd(uint64_t* dst, const uint64_t* src, size_t n, uint64_t scalar)
+{
+#ifdef NOTIFICATIONLIB_X86_CLMUL
+  if (s_useClmul)
+  {
+    gfMulAddClmul(dst, src, n, scalar);
+    return;
+  }
+#endif
+  for (size_t i = 0; i < n; i++)
+    dst[i] ^= gfMulPortable(scalar, src[i]);
+}
+
+// squaring is linear in GF(2^n): spread the bits apart, then reduce
+static inline uint64_t
+spreadBits(uint32_t half)
+{
+  uint64_t x = half;
+  x = (x | (x << 16)) & 0x0000FFFF0000FFFFULL;
+  x = (x | (x << 8)) & 0x00FF00FF00FF00FFULL;
+  x = (x | (x << 4)) & 0x0F0F0F0F0F0F0F0FULL;
+  x = (x | (x << 2)) & 0x3333333333333333ULL;
+  x = (x | (x << 1)) & 0x5555555555555555ULL;
+  return x;
+}
+
+static inline uint64_t
+gfSquare(uint64_t a)
+{
+  return gfReduce(spreadBits(a >> 32), spreadBits(static_cast<uint32_t>(a)));
+}
+
+// a^(2^64 - 2), a != 0
+static uint64_t
+gfInverse(uint64_t a)
+{
+  uint64_t result = 1;
+  for (int i = 1; i < 64; i++)
+  {
+    a = gfSquare(a);
+    result = gfMul(result, a);
+  }
+  return result;
+}
+
+// polynomials over the field, lowest coefficient first, no leading zeros
+
+typedef std::vector<uint64_t> Poly;
+
+static void
+polyTrim(Poly& a)
+{
+  while (!a.empty() && a.back() == 0)
+    a.pop_back();
+}
+
+static void
+polyMakeMonic(Poly& a)
+{
+  if (a.empty() || a.back() == 1)
+    return;
+  uint64_t inverse = gfInverse(a.back());
+  for (auto& coefficient: a)
+    coefficient = gfMul(coefficient, inverse);
+}
+
+// a mod m, m monic
+static void
+polyMod(Poly& a, const Poly& m)
+{
+  size_t degree = m.size() - 1;
+  while (a.size() > degree)
+  {
+    uint64_t top = a.back();
+    if (top != 0)
+    {
+      gfMulAdd(&a[a.size() - 1 - degree], m.data(), degree, top);
+    }
+    a.pop_back();
+  }
+  polyTrim(a);
+}
+
+// a / m when m divides a, m monic
+static Poly
+polyDivide(Poly a, const Poly& m)
+{
+  size_t degree = m.size() - 1;
+  Poly quotient(a.size() - degree);
+  for (size_t i = a.size(); i-- > degree;)
+  {
+    uint64_t top = a[i];
+    quotient[i - degree] = top;
+    if (top != 0)
+      gfMulAdd(&a[i - degree], m.data(), degree, top);
+  }
+  return quotient;
+}
+
+// a^2 mod m, m monic
+static void
+polySquareMod(Poly& a, const Poly& m)
+{
+  if (a.empty())
+    return;
+  Poly square(2 * a.size() - 1, 0);
+  for (size_t i = 0; i < a.size(); i++)
+    square[2 * i] = gfSquare(a[i]);
+  a.swap(square);
+  polyMod(a, m);
+}
+
+// monic gcd
+static Poly
+polyGcd(Poly a, Poly b)
+{
+  polyTrim(a);
+  polyTrim(b);
+  while (!b.empty())
+  {
+    polyMakeMonic(b);
+    polyMod(a, b);
+    a.swap(b);
+  }
+  polyMakeMonic(a);
+  return a;
+}
+
+static uint64_t
+splitMix64(uint64_t& state)
+{
+  uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+static void
+polyAdd(Poly& a, const Poly& b)
+{
+  if (a.size() < b.size())
+    a.resize(b.size(), 0);
+  for (size_t i = 0; i < b.size(); i++)
+    a[i] ^= b[i];
+  polyTrim(a);
+}
+
+// roots of f, monic and known to have distinct roots all in the field:
+// Tr(beta x) is 0 or 1 at each root, so gcd(f, Tr(beta x) mod f) splits
+// f for most beta (Berlekamp's trace algorithm). trace, if not null, is
+// Tr(beta x) mod f for some beta, tried first.
+static bool
+findRoots(const Poly& f, const Poly* trace, std::vector<uint64_t>& roots, uint64_t& seed)
+{
+  if (f.size() == 2)
+  {
+    roots.push_back(f[0]);
+    return true;
+  }
+
+  for (int attempt = 0; attempt < 64; attempt++)
+  {
+    Poly randomTrace;
+    if (attempt > 0 || trace == nullptr)
+    {
+      uint64_t beta = splitMix64(seed);
+      if (beta == 0)
+        continue;
+      Poly power = {0, beta};
+      randomTrace = power;
+      for (int i = 1; i < 64; i++)
+      {
+        polySquareMod(power, f);
+        polyAdd(randomTrace, power);
+      }
+      trace = &randomTrace;
+    }
+    Poly factor = polyGcd(f, *trace);
+    if (factor.size() > 1 && factor.size() < f.size())
+      return findRoots(factor, nullptr, roots, seed) &&
+             findRoots(polyDivide(f, factor), nullptr, roots, seed);
+  }
+  return false;
+}
+
+PinSketch::PinSketch(size_t capacity)
+  : m_syndromes(capacity, 0)
+{
+}
+
+void
+PinSketch::add(uint64_t key)
+{
+  uint64_t square = gfSquare(key);
+  uint64_t power = key;
+  for (auto& syndrome: m_syndromes)
+  {
+    syndrome ^= power;
+    power = gfMul(power, square);
+  }
+}
+
+void
+PinSketch::merge(const PinSketch& other)
+{
+  if (other.m_syndromes.size() < m_syndromes.size())
+    m_syndromes.resize(other.m_syndromes.size());
+  for (size_t i = 0; i < m_syndromes.size(); i++)
+    m_syndromes[i] ^= other.m_syndromes[i];
+}
+
+bool
+PinSketch::decode(std::vector<uint64_t>& elements) const
+{
+  return decode(elements, m_syndromes.size());
+}
+
+bool
+PinSketch::decode(std::vector<uint64_t>& elements, size_t maxElements) const
+{
+  elements.clear();
+  size_t capacity = std::min(maxElements, m_syndromes.size());
+
+  // power sums s1 ... s2c; the even ones are squares, s(2i) = s(i)^2
+  std::vector<uint64_t> sums(2 * capacity);
+  for (size_t i = 0; i < capacity; i++)
+    sums[2 * i] = m_syndromes[i];
+  for (size_t i = 1; i <= capacity; i++)
+    sums[2 * i - 1] = gfSquare(sums[i - 1]);
+
+  // Berlekamp-Massey: the shortest C with sum C[i] s(n-i) = 0, which is
+  // the product of (1 - key x)
+  Poly connection = {1};
+  Poly previous = {1};
+  size_t length = 0;
+  size_t gap = 1;
+  uint64_t previousInverse = 1;
+  for (size_t n = 0; n < sums.size(); n++)
+  {
+    uint64_t discrepancy = sums[n];
+    for (size_t i = 1; i <= length && i < connection.size(); i++)
+      discrepancy ^= gfMul(connection[i], sums[n - i]);
+    if (discrepancy == 0)
+    {
+      gap++;
+      continue;
+    }
+
+    uint64_t scale = gfMul(discrepancy, previousInverse);
+    bool lengthens = 2 * length <= n;
+    Poly saved;
+    if (lengthens)
+      saved = connection;
+    if (connection.size() < previous.size() + gap)
+      connection.resize(previous.size() + gap, 0);
+    gfMulAdd(&connection[gap], previous.data(), previous.size(), scale);
+
+    if (lengthens)
+    {
+      length = n + 1 - length;
+      previous.swap(saved);
+      previousInverse = gfInverse(discrepancy);
+      gap = 1;
+    }
+    else
+      gap++;
+  }
+  polyTrim(connection);
+
+  if (length == 0)
+    return true;
+  if (length > capacity || connection.size() != length + 1)
+    return false;
+
+  // reversed, the keys are the roots: x^L C(1/x) = product of (x - key)
+  Poly locator(connection.rbegin(), connection.rend());
+  polyMakeMonic(locator);
+
+  // more than capacity keys give a locator without length distinct
+  // roots in the field: check x^(2^64) = x mod locator first, it is
+  // cheaper than a failed split. The squarings on the way add up to
+  // Tr(x), the first split to try.
+  Poly x = {0, 1};
+  polyMod(x, locator);
+  Poly power = x;
+  Poly trace = x;
+  for (int i = 1; i <= 64; i++)
+  {
+    polySquareMod(power, locator);
+    if (i < 64)
+      polyAdd(trace, power);
+  }
+  if (power != x)
+    return false;
+
+  uint64_t seed = locator[0];
+  elements.reserve(length);
+  if (!findRoots(locator, &trace, elements, seed))
+  {
+    elements.clear();
+    return false;
+  }
+
+  // the roots must give back the same sketch, spare power sums included
+  PinSketch check(m_syndromes.size());
+  for (auto element: elements)
+    check.add(element);
+  if (check.m_syndromes != m_syndromes)
+  {
+    elements.clear();
+    return false;
+  }
+  return true;
+}
+
+Block
+PinSketch::wireEncode() const
+{
+  std::vector<uint8_t> bytes(8 * m_syndromes.size());
+  for (size_t i = 0; i < m_syndromes.size(); i++)
+    for (int j = 0; j < 8; j++)
+      bytes[8 * i + j] = static_cast<uint8_t>(m_syndromes[i] >> (8 * j));
+
+  EncodingEstimator estimator;
+  size_t estimatedSize = estimator.prependByteArrayBlock(tlv::SketchTable, bytes.data(), bytes.size());
+
+  EncodingBuffer buffer(estimatedSize);
+  buffer.prependByteArrayBlock(tlv::SketchTable, bytes.data(), bytes.size());
+  return buffer.block();
+}
+
+bool
+PinSketch::wireDecode(const Block& wire)
+{
+  if (wire.type() != tlv::SketchTable || wire.value_size() == 0 ||
+      wire.value_size() % 8 != 0)
+    return false;
+
+  const uint8_t* bytes = wire.value();
+  m_syndromes.assign(wire.value_size() / 8, 0);
+  for (size_t i = 0; i < m_syndromes.size(); i++)
+    for (int j = 0; j < 8; j++)
+      m_syndromes[i] |= static_cast<uint64_t>(bytes[8 * i + j]) << (8 * j);
+  return true;
+}
+
+bool
+PinSketch::isClmulEnabled()
+{
+#ifdef NOTIFICATIONLIB_X86_CLMUL
+  return s_useClmul;
+#else
+  return false;
+#endif
+}
+
+void
+PinSketch::setClmulEnabled(bool enabled)
+{
+#ifdef NOTIFICATIONLIB_X86_CLMUL
+  s_useClmul = enabled && s_hasClmul;
+#else
+  (void)enabled;
+#endif
+}
+
+} // namespace notificationLib
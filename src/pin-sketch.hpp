@@ -0,0 +1,95 @@
+/* -*- Mode:C++; c-file-style:"bsd"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright 2020 Washington University in St. Louis
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NOTIFICATIONLIB_PIN_SKETCH_HPP
+#define NOTIFICATIONLIB_PIN_SKETCH_HPP
+
+#include "common.hpp"
+
+namespace notificationLib {
+
+/**
+ * PinSketch of a set of non-zero 64-bit keys, the state of
+ * StateType::SKETCH.
+ *
+ * The sketch holds the odd power sums s1, s3, ..., s(2c-1) of its keys
+ * in GF(2^64), 8 bytes per unit of capacity c. Adding a key twice
+ * removes it, and merging two sketches gives the sketch of their
+ * symmetric difference, which decodes back to its keys as long as
+ * there are at most c of them (Berlekamp-Massey, then root finding by
+ * trace splitting). A capacity-c sketch is a prefix of a larger one, so
+ * sketches of different capacities merge at the smaller.
+ *
+ * Field multiplications use the carry-less multiply instruction where
+ * the CPU has it (PCLMULQDQ on x86-64, checked at run time), else a
+ * portable 4-bit windowed multiply.
+ */
+class PinSketch
+{
+public:
+  explicit
+  PinSketch(size_t capacity = 0);
+
+  size_t
+  getCapacity() const
+  {
+    return m_syndromes.size();
+  }
+
+  // adds key, or removes it if present; key must not be 0
+  void
+  add(uint64_t key);
+
+  // the sketch of the symmetric difference of both sets
+  void
+  merge(const PinSketch& other);
+
+  // the keys of the set; false if it holds more than capacity keys
+  // (elements is then left empty). A larger set is not always caught:
+  // it can decode to another set with the same power sums
+  bool
+  decode(std::vector<uint64_t>& elements) const;
+
+  // the same for at most maxElements keys; the power sums left over
+  // check the result, each one lowering the odds of a wrong set 2^64
+  // times
+  bool
+  decode(std::vector<uint64_t>& elements, size_t maxElements) const;
+
+  // tlv::SketchTable: the power sums, 8 bytes each, little endian
+  Block
+  wireEncode() const;
+
+  // false if wire is not a well formed tlv::SketchTable
+  bool
+  wireDecode(const Block& wire);
+
+  // whether the carry-less multiply instruction is used; it can be
+  // turned off (to compare), not on where the CPU lacks it
+  static bool
+  isClmulEnabled();
+
+  static void
+  setClmulEnabled(bool enabled);
+
+private:
+  std::vector<uint64_t> m_syndromes;
+};
+
+} // namespace notificationLib
+
+#endif // NOTIFICATIONLIB_PIN_SKETCH_HPP
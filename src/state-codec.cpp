@@ -0,0 +1,439 @@
+/* -*- Mode:C++; c-file-style:"bsd"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright 2020 Washington University in St. Louis
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "state-codec.hpp"
+#include "logger.hpp"
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+
+namespace notificationLib {
+
+INIT_LOGGER(stateCodec);
+
+const size_t StateCodec::MAX_STATE_SIZE;
+
+#ifdef HAVE_ZSTD
+// contexts are reused across calls, creating one costs more than
+// compressing a typical state
+struct ZstdContexts
+{
+  ZstdContexts()
+    : cctx(ZSTD_createCCtx())
+    , dctx(ZSTD_createDCtx())
+  {
+  }
+
+  ~ZstdContexts()
+  {
+    ZSTD_freeCCtx(cctx);
+    ZSTD_freeDCtx(dctx);
+  }
+
+  ZSTD_CCtx* cctx;
+  ZSTD_DCtx* dctx;
+};
+
+static ZstdContexts&
+zstdContexts()
+{
+  static thread_local ZstdContexts contexts;
+  return contexts;
+}
+
+// digested dictionaries, by dictionary id
+struct ZstdDictionary
+{
+  ZstdDictionary()
+    : cdict(nullptr)
+    , ddict(nullptr)
+  {
+  }
+
+  ~ZstdDictionary()
+  {
+    ZSTD_freeCDict(cdict);
+    ZSTD_freeDDict(ddict);
+  }
+
+  ZSTD_CDict* cdict;
+  ZSTD_DDict* ddict;
+};
+
+static std::map<uint32_t, std::unique_ptr<ZstdDictionary>>&
+zstdDictionaries()
+{
+  static std::map<uint32_t, std::unique_ptr<ZstdDictionary>> dictionaries;
+  return dictionaries;
+}
+
+static const ZstdDictionary*
+findDictionary(uint32_t dictionaryId)
+{
+  auto it = zstdDictionaries().find(dictionaryId);
+  return it == zstdDictionaries().end() ? nullptr : it->second.get();
+}
+#endif
+
+#ifdef HAVE_ZLIB
+// same for zlib, whose streams allocate their window on init
+struct DeflateStreams
+{
+  DeflateStreams()
+  {
+    std::memset(&deflater, 0, sizeof(deflater));
+    std::memset(&inflater, 0, sizeof(inflater));
+    // negative window bits: raw deflate, no zlib header or checksum
+    deflateOk = deflateInit2(&deflater, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                             -15, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    inflateOk = inflateInit2(&inflater, -15) == Z_OK;
+  }
+
+  ~DeflateStreams()
+  {
+    if (deflateOk)
+      deflateEnd(&deflater);
+    if (inflateOk)
+      inflateEnd(&inflater);
+  }
+
+  z_stream deflater;
+  z_stream inflater;
+  bool deflateOk;
+  bool inflateOk;
+};
+
+static DeflateStreams&
+deflateStreams()
+{
+  static thread_local DeflateStreams streams;
+  return streams;
+}
+#endif
+
+bool
+StateCodec::isSupported(int codec)
+{
+  switch (codec) {
+  case CodecType::BZIP2:
+  case CodecType::NONE:
+    return true;
+#ifdef HAVE_LZ4
+  case CodecType::LZ4:
+    return true;
+#endif
+#ifdef HAVE_ZSTD
+  case CodecType::ZSTD:
+  case CodecType::ZSTD_DICT:
+    return true;
+#endif
+#ifdef HAVE_ZLIB
+  case CodecType::DEFLATE:
+    return true;
+#endif
+  default:
+    return false;
+  }
+}
+
+int
+StateCodec::getCodec(const uint8_t* buffer, size_t bufferSize)
+{
+  if (bufferSize == 0)
+    return 0;
+  if (buffer[0] == 'B')
+    return CodecType::BZIP2;
+  return buffer[0];
+}
+
+uint32_t
+StateCodec::addDictionary(const uint8_t* dictionary, size_t dictionarySize)
+{
+#ifdef HAVE_ZSTD
+  uint32_t dictionaryId = ZSTD_getDictID_fromDict(dictionary, dictionarySize);
+  if (dictionaryId == 0)
+  {
+    _LOG_ERROR("StateCodec::addDictionary: not a zstd dictionary");
+    return 0;
+  }
+
+  std::unique_ptr<ZstdDictionary> digested(new ZstdDictionary);
+  digested->cdict = ZSTD_createCDict(dictionary, dictionarySize, ZSTD_CLEVEL_DEFAULT);
+  digested->ddict = ZSTD_createDDict(dictionary, dictionarySize);
+  if (digested->cdict == nullptr || digested->ddict == nullptr)
+    return 0;
+
+  zstdDictionaries()[dictionaryId] = std::move(digested);
+  return dictionaryId;
+#else
+  _LOG_ERROR("StateCodec::addDictionary: built without zstd");
+  return 0;
+#endif
+}
+
+uint32_t
+StateCodec::loadDictionary(const std::string& fileName)
+{
+  std::ifstream input(fileName, std::ios::binary);
+  if (!input)
+  {
+    _LOG_ERROR("StateCodec::loadDictionary: cannot open " << fileName);
+    return 0;
+  }
+  std::vector<uint8_t> dictionary((std::istreambuf_iterator<char>(input)),
+                                  std::istreambuf_iterator<char>());
+  return addDictionary(dictionary.data(), dictionary.size());
+}
+
+ConstBufferPtr
+StateCodec::compress(int codec, const uint8_t* buffer, size_t bufferSize,
+                     uint32_t dictionaryId)
+{
+  ConstBufferPtr out = _compress(codec, buffer, bufferSize, dictionaryId);
+  if (out == nullptr)
+  {
+    // the state still goes into names, uncompressed
+    _LOG_ERROR("StateCodec::compress: codec " << codec << " failed, state stored uncompressed");
+    out = _compress(CodecType::NONE, buffer, bufferSize, 0);
+  }
+  return out;
+}
+
+ConstBufferPtr
+StateCodec::_compress(int codec, const uint8_t* buffer, size_t bufferSize,
+                      uint32_t dictionaryId)
+{
+  if (codec == CodecType::BZIP2)
+    return bzip2::compress(reinterpret_cast<const char*>(buffer), bufferSize);
+
+  if (!isSupported(codec))
+  {
+    _LOG_ERROR("StateCodec::compress: codec " << codec << " not supported");
+    return nullptr;
+  }
+
+  std::vector<uint8_t> header;
+  header.push_back(static_cast<uint8_t>(codec));
+  if (codec == CodecType::ZSTD_DICT)
+    appendVarint(header, dictionaryId);
+  appendVarint(header, bufferSize);
+
+  size_t bound = bufferSize;
+#ifdef HAVE_LZ4
+  if (codec == CodecType::LZ4)
+    bound = LZ4_compressBound(bufferSize);
+#endif
+#ifdef HAVE_ZSTD
+  if (codec == CodecType::ZSTD || codec == CodecType::ZSTD_DICT)
+    bound = ZSTD_compressBound(bufferSize);
+#endif
+#ifdef HAVE_ZLIB
+  if (codec == CodecType::DEFLATE)
+    bound = deflateBound(&deflateStreams().deflater, bufferSize);
+#endif
+
+  auto out = make_shared<ndn::Buffer>(header.size() + bound);
+  std::copy(header.begin(), header.end(), out->begin());
+  uint8_t* payload = out->data() + header.size();
+  size_t payloadSize = 0;
+
+  switch (codec) {
+  case CodecType::NONE:
+    std::copy(buffer, buffer + bufferSize, payload);
+    payloadSize = bufferSize;
+    break;
+#ifdef HAVE_LZ4
+  case CodecType::LZ4:
+    {
+      int written = LZ4_compress_default(reinterpret_cast<const char*>(buffer),
+                                         reinterpret_cast<char*>(payload),
+                                         bufferSize, bound);
+      if (written <= 0)
+        return nullptr;
+      payloadSize = written;
+      break;
+    }
+#endif
+#ifdef HAVE_ZSTD
+  case CodecType::ZSTD:
+    {
+      size_t written = ZSTD_compressCCtx(zstdContexts().cctx, payload, bound,
+                                         buffer, bufferSize, ZSTD_CLEVEL_DEFAULT);
+      if (ZSTD_isError(written))
+      {
+        _LOG_ERROR("StateCodec::compress: " << ZSTD_getErrorName(written));
+        return nullptr;
+      }
+      payloadSize = written;
+      break;
+    }
+  case CodecType::ZSTD_DICT:
+    {
+      const ZstdDictionary* dictionary = findDictionary(dictionaryId);
+      if (dictionary == nullptr)
+      {
+        _LOG_ERROR("StateCodec::compress: dictionary " << dictionaryId << " not loaded");
+        return nullptr;
+      }
+      // the size and dictionary id are in our own header already
+      ZSTD_CCtx* cctx = zstdContexts().cctx;
+      ZSTD_CCtx_reset(cctx, ZSTD_reset_session_and_parameters);
+      ZSTD_CCtx_setParameter(cctx, ZSTD_c_contentSizeFlag, 0);
+      ZSTD_CCtx_setParameter(cctx, ZSTD_c_dictIDFlag, 0);
+      ZSTD_CCtx_refCDict(cctx, dictionary->cdict);
+      size_t written = ZSTD_compress2(cctx, payload, bound, buffer, bufferSize);
+      ZSTD_CCtx_reset(cctx, ZSTD_reset_session_and_parameters);
+      if (ZSTD_isError(written))
+      {
+        _LOG_ERROR("StateCodec::compress: " << ZSTD_getErrorName(written));
+        return nullptr;
+      }
+      payloadSize = written;
+      break;
+    }
+#endif
+#ifdef HAVE_ZLIB
+  case CodecType::DEFLATE:
+    {
+      DeflateStreams& streams = deflateStreams();
+      if (!streams.deflateOk || deflateReset(&streams.deflater) != Z_OK)
+        return nullptr;
+      streams.deflater.next_in = const_cast<Bytef*>(buffer);
+      streams.deflater.avail_in = bufferSize;
+      streams.deflater.next_out = payload;
+      streams.deflater.avail_out = bound;
+      if (deflate(&streams.deflater, Z_FINISH) != Z_STREAM_END)
+        return nullptr;
+      payloadSize = streams.deflater.total_out;
+      break;
+    }
+#endif
+  default:
+    return nullptr;
+  }
+
+  out->resize(header.size() + payloadSize);
+  return out;
+}
+
+ConstBufferPtr
+StateCodec::decompress(const uint8_t* buffer, size_t bufferSize)
+{
+  int codec = getCodec(buffer, bufferSize);
+  if (codec == CodecType::BZIP2)
+  {
+    try {
+      return bzip2::decompress(reinterpret_cast<const char*>(buffer), bufferSize);
+    }
+    catch (const std::exception& e) {
+      _LOG_ERROR("StateCodec::decompress: " << e.what());
+      return nullptr;
+    }
+  }
+
+  if (!isSupported(codec))
+  {
+    _LOG_ERROR("StateCodec::decompress: codec " << codec << " not supported");
+    return nullptr;
+  }
+
+  const uint8_t* pos = buffer + 1;
+  const uint8_t* end = buffer + bufferSize;
+  uint64_t dictionaryId = 0;
+  uint64_t originalSize;
+  if ((codec == CodecType::ZSTD_DICT && !readVarint(pos, end, dictionaryId)) ||
+      !readVarint(pos, end, originalSize) || originalSize > MAX_STATE_SIZE)
+  {
+    _LOG_ERROR("StateCodec::decompress: bad header");
+    return nullptr;
+  }
+  size_t payloadSize = end - pos;
+
+  auto out = make_shared<ndn::Buffer>(originalSize);
+  bool ok = false;
+
+  switch (codec) {
+  case CodecType::NONE:
+    ok = payloadSize == originalSize;
+    if (ok)
+      std::copy(pos, end, out->begin());
+    break;
+#ifdef HAVE_LZ4
+  case CodecType::LZ4:
+    ok = LZ4_decompress_safe(reinterpret_cast<const char*>(pos),
+                             reinterpret_cast<char*>(out->data()),
+                             payloadSize, originalSize) == static_cast<int>(originalSize);
+    break;
+#endif
+#ifdef HAVE_ZSTD
+  case CodecType::ZSTD:
+    ok = ZSTD_decompressDCtx(zstdContexts().dctx, out->data(), originalSize,
+                             pos, payloadSize) == originalSize;
+    break;
+  case CodecType::ZSTD_DICT:
+    {
+      const ZstdDictionary* dictionary = findDictionary(dictionaryId);
+      if (dictionary == nullptr)
+      {
+        _LOG_ERROR("StateCodec::decompress: dictionary " << dictionaryId << " not loaded");
+        return nullptr;
+      }
+      ok = ZSTD_decompress_usingDDict(zstdContexts().dctx, out->data(), originalSize,
+                                      pos, payloadSize, dictionary->ddict) == originalSize;
+      break;
+    }
+#endif
+#ifdef HAVE_ZLIB
+  case CodecType::DEFLATE:
+    {
+      DeflateStreams& streams = deflateStreams();
+      if (!streams.inflateOk || inflateReset(&streams.inflater) != Z_OK)
+        break;
+      streams.inflater.next_in = const_cast<Bytef*>(pos);
+      streams.inflater.avail_in = payloadSize;
+      streams.inflater.next_out = out->data();
+      streams.inflater.avail_out = originalSize;
+      ok = inflate(&streams.inflater, Z_FINISH) == Z_STREAM_END &&
+           streams.inflater.total_out == originalSize;
+      break;
+    }
+#endif
+  default:
+    break;
+  }
+
+  if (!ok)
+  {
+    _LOG_ERROR("StateCodec::decompress: corrupt payload for codec " << codec);
+    return nullptr;
+  }
+  return out;
+}
+
+} // namespace notificationLib
@@ -0,0 +1,185 @@
+/* -*- Mode:C++; c-file-style:"bsd"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright 2020 Washington University in St. Louis
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NOTIFICATIONLIB_STATE_CODEC_HPP
+#define NOTIFICATIONLIB_STATE_CODEC_HPP
+
+#include "common.hpp"
+#include <sstream>
+#include <boost/iostreams/filtering_streambuf.hpp>
+#include <boost/iostreams/copy.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+
+#include <boost/iostreams/detail/iostream.hpp>
+#include <boost/iostreams/filter/bzip2.hpp>
+#include <boost/iostreams/copy.hpp>
+
+#include <ndn-cxx/encoding/buffer-stream.hpp>
+
+namespace notificationLib {
+
+// Compression applied to an encoded state before it goes into the
+// interest name. BZIP2 output is sent bare, as older versions expect;
+// every other codec is sent as
+//   [codec (1 byte)][uncompressed size (varint)][payload]
+// which never starts like a bzip2 stream ("BZh").
+namespace CodecType
+{
+  enum
+  {
+    BZIP2 = 1,
+    NONE = 2,
+    LZ4 = 3,   // needs liblz4 at build time
+    ZSTD = 4,  // needs libzstd at build time
+    DEFLATE = 5, // raw deflate, needs zlib at build time
+    ZSTD_DICT = 6 // zstd with a trained dictionary, needs libzstd;
+                  // the dictionary id follows the codec byte
+  };
+}
+
+class StateCodec
+{
+public:
+  // true if this build can compress and decompress with codec
+  static bool
+  isSupported(int codec);
+
+  // never nullptr: if codec is not supported by this build, its
+  // dictionary is not loaded or it fails, the payload is stored
+  // uncompressed (NONE), which every peer decodes
+  static ConstBufferPtr
+  compress(int codec, const uint8_t* buffer, size_t bufferSize,
+           uint32_t dictionaryId = 0);
+
+  // picks the codec from the payload, returns nullptr if the payload
+  // is malformed or its codec is not supported by this build
+  static ConstBufferPtr
+  decompress(const uint8_t* buffer, size_t bufferSize);
+
+  // codec a payload was compressed with, without decompressing it
+  static int
+  getCodec(const uint8_t* buffer, size_t bufferSize);
+
+  // Registers a zstd dictionary (as written by trainStateDictionary)
+  // for ZSTD_DICT. Dictionaries are process wide and should be loaded
+  // while reading the configuration. Returns the dictionary id, or 0
+  // if the dictionary is unusable or zstd is not available.
+  static uint32_t
+  addDictionary(const uint8_t* dictionary, size_t dictionarySize);
+
+  static uint32_t
+  loadDictionary(const std::string& fileName);
+
+  // upper bound on an uncompressed state, protects the decoder
+  static const size_t MAX_STATE_SIZE = 16 * 1024 * 1024;
+
+private:
+  // nullptr if codec cannot compress the payload
+  static ConstBufferPtr
+  _compress(int codec, const uint8_t* buffer, size_t bufferSize, uint32_t dictionaryId);
+};
+
+// LEB128 unsigned varint helpers
+inline void
+appendVarint(std::vector<uint8_t>& out, uint64_t value)
+{
+  while (value >= 0x80) {
+    out.push_back(static_cast<uint8_t>(value) | 0x80);
+    value >>= 7;
+  }
+  out.push_back(static_cast<uint8_t>(value));
+}
+
+inline bool
+readVarint(const uint8_t*& pos, const uint8_t* end, uint64_t& value)
+{
+  value = 0;
+  for (int shift = 0; pos != end && shift < 64; shift += 7) {
+    uint8_t byte = *pos++;
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0)
+      return true;
+  }
+  return false;
+}
+
+// class Gzip {
+// public:
+// 	static std::string compress(const std::string& data)
+// 	{
+// 		namespace bio = boost::iostreams;
+//
+// 		std::stringstream compressed;
+// 		std::stringstream origin(data);
+//
+// 		bio::filtering_streambuf<bio::input> out;
+// 		out.push(bio::gzip_compressor(bio::gzip_params(bio::gzip::best_compression)));
+// 		out.push(origin);
+// 		bio::copy(out, compressed);
+//
+// 		return compressed.str();
+// 	}
+//
+// 	static std::string decompress(const std::string& data)
+// 	{
+// 		namespace bio = boost::iostreams;
+//
+// 		std::stringstream compressed(data);
+// 		std::stringstream decompressed;
+//
+// 		bio::filtering_streambuf<bio::input> out;
+// 		out.push(bio::gzip_decompressor());
+// 		out.push(compressed);
+// 		bio::copy(out, decompressed);
+//
+// 		return decompressed.str();
+// 	}
+// };
+class bzip2 {
+
+public:
+  static std::shared_ptr<ndn::Buffer>
+  compress(const char* buffer, size_t bufferSize)
+  {
+    namespace bio = boost::iostreams;
+
+    ndn::OBufferStream os;
+    bio::filtering_streambuf<bio::output> out;
+    out.push(bio::bzip2_compressor());
+    out.push(os);
+    bio::stream<bio::array_source> in(reinterpret_cast<const char*>(buffer), bufferSize);
+    bio::copy(in, out);
+    return os.buf();
+  }
+
+  static std::shared_ptr<ndn::Buffer>
+  decompress(const char* buffer, size_t bufferSize)
+  {
+    namespace bio = boost::iostreams;
+    ndn::OBufferStream os;
+    bio::filtering_streambuf<bio::output> out;
+    out.push(bio::bzip2_decompressor());
+    out.push(os);
+    bio::stream<bio::array_source> in(reinterpret_cast<const char*>(buffer), bufferSize);
+    bio::copy(in, out);
+    return os.buf();
+  }
+};
+
+} // namespace notificationLib
+
+#endif // NOTIFICATIONLIB_STATE_CODEC_HPP
@@ -0,0 +1,272 @@
+/* -*- Mode:C++; c-file-style:"bsd"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright 2020 Washington University in St. Louis
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "state-file.hpp"
+#include "logger.hpp"
+#include "murmurhash3.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+INIT_LOGGER(stateFile);
+
+namespace notificationLib {
+
+static const char MAGIC[8] = {'N', 'L', 'S', 'T', 'A', 'T', 'E', 0};
+static const uint32_t FORMAT_VERSION = 1;
+
+// the layout is the file format, no padding may creep in
+static_assert(sizeof(StateFile::Header) == 96, "StateFile::Header is not packed");
+static_assert(sizeof(StateFile::Entry) == 24, "StateFile::Entry is not packed");
+
+static size_t
+align8(size_t size)
+{
+  return (size + 7) & ~static_cast<size_t>(7);
+}
+
+ConstBufferPtr
+StateFile::build(Header header, const uint8_t* cells, size_t cellBytes,
+                 const std::vector<Entry>& entries, const std::vector<uint32_t>& events,
+                 const std::vector<Name>& names)
+{
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.formatVersion = FORMAT_VERSION;
+  header.cellBytes = align8(cellBytes);
+  header.entryCount = entries.size();
+  header.eventCount = events.size();
+  header.nameCount = names.size();
+  header.nameBytes = 0;
+  for (auto const& name: names)
+    header.nameBytes += name.wireEncode().size();
+
+  size_t eventBytes = align8(events.size() * sizeof(uint32_t));
+  size_t offsetBytes = (names.size() + 1) * sizeof(uint64_t);
+  auto image = make_shared<ndn::Buffer>(sizeof(Header) + header.cellBytes +
+                                        entries.size() * sizeof(Entry) + eventBytes +
+                                        offsetBytes + align8(header.nameBytes));
+  uint8_t* out = image->data() + sizeof(Header);
+  std::memset(out, 0, image->size() - sizeof(Header));
+  if (cellBytes > 0)
+    std::memcpy(out, cells, cellBytes);
+  out += header.cellBytes;
+  if (!entries.empty())
+    std::memcpy(out, entries.data(), entries.size() * sizeof(Entry));
+  out += entries.size() * sizeof(Entry);
+  if (!events.empty())
+    std::memcpy(out, events.data(), events.size() * sizeof(uint32_t));
+  out += eventBytes;
+
+  uint8_t* blob = out + offsetBytes;
+  uint64_t offset = 0;
+  for (auto const& name: names)
+  {
+    std::memcpy(out, &offset, sizeof(offset));
+    out += sizeof(offset);
+    const Block& wire = name.wireEncode();
+    std::memcpy(blob + offset, wire.wire(), wire.size());
+    offset += wire.size();
+  }
+  std::memcpy(out, &offset, sizeof(offset));
+
+  header.checksum = MurmurHash3(0, image->data() + sizeof(Header),
+                                image->size() - sizeof(Header));
+  std::memcpy(image->data(), &header, sizeof(Header));
+  return image;
+}
+
+bool
+StateFile::write(const std::string& path, const ndn::Buffer& image)
+{
+  std::string temporary = path + ".tmp";
+  int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+  {
+    _LOG_ERROR("StateFile::write: cannot open " << temporary << ": " << std::strerror(errno));
+    return false;
+  }
+
+  const uint8_t* data = image.data();
+  size_t left = image.size();
+  while (left > 0)
+  {
+    ssize_t written = ::write(fd, data, left);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written <= 0)
+    {
+      _LOG_ERROR("StateFile::write: cannot write " << temporary << ": " << std::strerror(errno));
+      ::close(fd);
+      ::unlink(temporary.c_str());
+      return false;
+    }
+    data += written;
+    left -= written;
+  }
+  // the data must be on disk before the rename makes it the file
+  if (::fsync(fd) != 0 || ::close(fd) != 0)
+  {
+    _LOG_ERROR("StateFile::write: cannot sync " << temporary << ": " << std::strerror(errno));
+    ::unlink(temporary.c_str());
+    return false;
+  }
+  if (std::rename(temporary.c_str(), path.c_str()) != 0)
+  {
+    _LOG_ERROR("StateFile::write: cannot rename to " << path << ": " << std::strerror(errno));
+    ::unlink(temporary.c_str());
+    return false;
+  }
+
+  // and the rename before we count on it
+  size_t slash = path.rfind('/');
+  std::string directory = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+  int dirFd = ::open(directory.c_str(), O_RDONLY);
+  if (dirFd >= 0)
+  {
+    ::fsync(dirFd);
+    ::close(dirFd);
+  }
+  return true;
+}
+
+bool
+StateFile::open(const std::string& path)
+{
+  try
+  {
+    m_file.open(path);
+  }
+  catch (const std::exception& e)
+  {
+    _LOG_INFO("StateFile::open: no state file " << path << ": " << e.what());
+    return false;
+  }
+
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(m_file.data());
+  size_t size = m_file.size();
+  if (size < sizeof(Header))
+  {
+    _LOG_ERROR("StateFile::open: " << path << " is truncated");
+    return false;
+  }
+  std::memcpy(&m_header, data, sizeof(Header));
+  if (std::memcmp(m_header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+      m_header.formatVersion != FORMAT_VERSION)
+  {
+    _LOG_ERROR("StateFile::open: " << path << " is not a state file of this version");
+    return false;
+  }
+
+  // the section sizes are checked before they are added up, a damaged
+  // header must not wrap the sum around
+  const uint64_t limit = size;
+  if (m_header.cellBytes > limit || m_header.cellBytes % 8 != 0 ||
+      m_header.entryCount > limit / sizeof(Entry) ||
+      m_header.eventCount > limit / sizeof(uint32_t) ||
+      m_header.nameCount > limit / sizeof(uint64_t) || m_header.nameBytes > limit)
+  {
+    _LOG_ERROR("StateFile::open: " << path << " has a damaged header");
+    return false;
+  }
+  uint64_t expected = sizeof(Header) + m_header.cellBytes + m_header.entryCount * sizeof(Entry) +
+                      align8(m_header.eventCount * sizeof(uint32_t)) +
+                      (m_header.nameCount + 1) * sizeof(uint64_t) + align8(m_header.nameBytes);
+  if (expected != size ||
+      MurmurHash3(0, data + sizeof(Header), size - sizeof(Header)) != m_header.checksum)
+  {
+    _LOG_ERROR("StateFile::open: " << path << " is damaged");
+    return false;
+  }
+
+  m_cells = data + sizeof(Header);
+  m_entries = m_cells + m_header.cellBytes;
+  m_events = m_entries + m_header.entryCount * sizeof(Entry);
+  const uint8_t* offsets = m_events + align8(m_header.eventCount * sizeof(uint32_t));
+  const uint8_t* blob = offsets + (m_header.nameCount + 1) * sizeof(uint64_t);
+
+  // the references between sections, so readers need not check them
+  for (size_t i = 0; i < m_header.entryCount; i++)
+  {
+    Entry entry = getEntry(i);
+    if (static_cast<uint64_t>(entry.firstEvent) + entry.eventCount > m_header.eventCount)
+    {
+      _LOG_ERROR("StateFile::open: " << path << " has an entry past the events");
+      return false;
+    }
+  }
+  for (size_t i = 0; i < m_header.eventCount; i++)
+  {
+    uint32_t index;
+    std::memcpy(&index, m_events + i * sizeof(index), sizeof(index));
+    if (index >= m_header.nameCount)
+    {
+      _LOG_ERROR("StateFile::open: " << path << " has an event past the names");
+      return false;
+    }
+  }
+
+  m_names.clear();
+  m_names.reserve(m_header.nameCount);
+  try
+  {
+    for (size_t i = 0; i < m_header.nameCount; i++)
+    {
+      uint64_t begin, end;
+      std::memcpy(&begin, offsets + i * sizeof(uint64_t), sizeof(begin));
+      std::memcpy(&end, offsets + (i + 1) * sizeof(uint64_t), sizeof(end));
+      if (begin > end || end > m_header.nameBytes)
+      {
+        _LOG_ERROR("StateFile::open: " << path << " has a name past the blob");
+        return false;
+      }
+      m_names.push_back(Name(Block(blob + begin, end - begin)));
+    }
+  }
+  catch (const std::exception& e)
+  {
+    _LOG_ERROR("StateFile::open: " << path << " has a bad name: " << e.what());
+    return false;
+  }
+  return true;
+}
+
+StateFile::Entry
+StateFile::getEntry(size_t i) const
+{
+  Entry entry;
+  std::memcpy(&entry, m_entries + i * sizeof(Entry), sizeof(Entry));
+  return entry;
+}
+
+void
+StateFile::getEvents(const Entry& entry, std::vector<Name>& eventList) const
+{
+  eventList.clear();
+  eventList.reserve(entry.eventCount);
+  for (uint32_t i = 0; i < entry.eventCount; i++)
+  {
+    uint32_t index;
+    std::memcpy(&index, m_events + (entry.firstEvent + i) * sizeof(index), sizeof(index));
+    eventList.push_back(m_names[index]);
+  }
+}
+
+} // namespace notificationLib
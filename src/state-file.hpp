@@ -0,0 +1,125 @@
+/* -*- Mode:C++; c-file-style:"bsd"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright 2020 Washington University in St. Louis
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NOTIFICATIONLIB_STATE_FILE_HPP
+#define NOTIFICATIONLIB_STATE_FILE_HPP
+
+#include "common.hpp"
+
+#include <boost/iostreams/device/mapped_file.hpp>
+
+namespace notificationLib {
+
+/**
+ * A State saved to a local file, for warm restarts (State::saveImage,
+ * State::restore).
+ *
+ * Fixed-width little-endian sections, each 8-byte aligned, so a mapped
+ * file is read in place:
+ *
+ *   header    StateFile::Header
+ *   cells     the IBF, as IBFT::writeCellImage
+ *   entries   entryCount StateFile::Entry, in timestamp order
+ *   events    eventCount uint32 name indexes, padded to 8 bytes
+ *   names     nameCount + 1 uint64 offsets into the blob that follows,
+ *             holding every distinct event name TLV once
+ *
+ * The header ends with a checksum of the rest, so a torn or mixed up
+ * file is rejected as a whole. write() goes through a temporary file
+ * that is synced and renamed over the old one: after a crash the path
+ * holds either the previous file or the new one.
+ */
+class StateFile
+{
+public:
+  struct Header
+  {
+    char magic[8];
+    uint32_t formatVersion;
+    uint32_t stateType;
+    // TUPLE: the producer index of the saving state
+    uint64_t localIndex;
+    uint64_t keyBase;
+    uint64_t keyResolution;
+    uint32_t hashType;
+    uint32_t cellCount;
+    uint64_t cellBytes;
+    uint64_t entryCount;
+    uint64_t eventCount;
+    uint64_t nameCount;
+    uint64_t nameBytes;
+    // MurmurHash3 of everything after the header
+    uint64_t checksum;
+  };
+
+  struct Entry
+  {
+    uint64_t timestamp;
+    // TUPLE: producer index, 0 if unknown
+    uint64_t producer;
+    // index of the first event name index, in the events section
+    uint32_t firstEvent;
+    uint32_t eventCount;
+  };
+
+  // header fields other than the magic, section sizes and checksum
+  // must be set; the events are indexes into names
+  static ConstBufferPtr
+  build(Header header, const uint8_t* cells, size_t cellBytes,
+        const std::vector<Entry>& entries, const std::vector<uint32_t>& events,
+        const std::vector<Name>& names);
+
+  // false if the file cannot be written, synced or renamed
+  static bool
+  write(const std::string& path, const ndn::Buffer& image);
+
+  // maps path; false if it is missing, of another format or damaged
+  bool
+  open(const std::string& path);
+
+  const Header&
+  getHeader() const
+  {
+    return m_header;
+  }
+
+  // cellBytes of them, valid while the file is open
+  const uint8_t*
+  getCells() const
+  {
+    return m_cells;
+  }
+
+  Entry
+  getEntry(size_t i) const;
+
+  // the names of entry's events, decoded once by open()
+  void
+  getEvents(const Entry& entry, std::vector<Name>& eventList) const;
+
+private:
+  boost::iostreams::mapped_file_source m_file;
+  Header m_header;
+  const uint8_t* m_cells;
+  const uint8_t* m_entries;
+  const uint8_t* m_events;
+  std::vector<Name> m_names;
+};
+
+} // namespace notificationLib
+
+#endif // NOTIFICATIONLIB_STATE_FILE_HPP
@@ -18,25 +18,68 @@
 #include "state.hpp"
 #include "logger.hpp"
 #include "murmurhash3.hpp"
+#include "state-file.hpp"
+#include <ndn-cxx/util/sha256.hpp>
 #include <boost/iostreams/filtering_stream.hpp>
 #include <boost/iostreams/filter/gzip.hpp>
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <map>
 #include <random>
 
 INIT_LOGGER(state);
 
 namespace notificationLib {
 
-State::State(size_t maxNotificationMemory, int stateType)
+const size_t StateSnapshot::RANGE_FANOUT;
+
+StateSnapshot::StateSnapshot(size_t maxNotificationMemory, int stateType,
+                             const StateOptions& options)
   : m_maxNotificationMemory(maxNotificationMemory)
+  , m_options(options)
   , m_stateType(stateType)
-  , m_ibft(maxNotificationMemory, 4) // 4 bytes hash value size in ibf
-                                     // key size (timestamp) is 8 bytes
+  , m_ibft(maxNotificationMemory, 4, options.hashType) // 4 bytes hash value size in ibf
+                                                       // key size (timestamp) is 8 bytes
+  , m_version(1)
+  , m_timestampHashSum(0)
+  // one power sum more than the capacity checks the decoded diff
+  , m_sketch(stateType == StateType::SKETCH ? options.sketchCapacity + 1 : 0)
+  , m_keyBase(0)
+{
+  m_ibft.setKeyBase(0, options.keyResolution);
+}
+
+// keyNode, or a random node if it is not set
+static uint32_t
+clockNodeOf(const StateOptions& options)
+{
+  if (options.keyNode >= 0)
+    return options.keyNode;
+
+  uint32_t node = std::random_device()() & ((1u << HybridClock::NODE_BITS) - 1);
+  if (options.keyClock == KeyClock::HYBRID)
+    _LOG_WARN("State::State(): no keyNode set, using random node " << node
+              << "; keys collide with a producer that draws the same");
+  return node;
+}
+
+State::State(size_t maxNotificationMemory, int stateType, const StateOptions& options)
+  : m_options(options)
+  , m_stateType(stateType)
+  , m_clock(clockNodeOf(options), options.keyMaxDrift)
+  , m_content(std::make_shared<StateSnapshot>(maxNotificationMemory, stateType, options))
+  , m_evictionCount(0)
+  , m_encodedStateVersion(0)
+  , m_stateDigestVersion(0)
 {
   if(stateType == StateType::TUPLE)
   {
     std::random_device rd;
     std::mt19937 mt(rd());
-    std::uniform_real_distribution<double> dist(1000, 10000);
+    // wide enough that two producers of a group practically never
+    // draw the same index
+    std::uniform_int_distribution<uint64_t> dist(1, std::numeric_limits<uint32_t>::max());
 
     m_localIndex = dist(mt);
     _LOG_INFO("State::State(): local random index is " << m_localIndex);
@@ -45,40 +88,102 @@ State::State(size_t maxNotificationMemory, int stateType)
     m_localIndex = 0;
 }
 
+StateSnapshot&
+State::_mutableContent()
+{
+  // only this thread hands out snapshots, so a count of one cannot
+  // grow behind our back
+  if (m_content.use_count() > 1)
+    m_content = std::make_shared<StateSnapshot>(*m_content);
+  else
+  {
+    // use_count() is a relaxed load: order the writes below after the
+    // reads of the thread that released the last snapshot
+    std::atomic_thread_fence(std::memory_order_acquire);
+  }
+  return *m_content;
+}
+
 void
-State::_addTimestamp(uint64_t timestamp, const std::vector<Name>& eventList, int partyIndex /*= 0*/)
+State::_addTimestamp(uint64_t timestamp, const std::vector<Name>& eventList,
+                     uint64_t partyIndex /*= 0*/)
 {
   _LOG_DEBUG("State::_addTimestamp(): index timestamp " << timestamp);
-  m_ibft.insert(timestamp, _pseudoRandomValue(timestamp));
+  if (m_options.keyClock == KeyClock::HYBRID)
+  {
+    auto now_ns = boost::chrono::time_point_cast<boost::chrono::nanoseconds>(ndn::time::system_clock::now());
+    if (!m_clock.observe(timestamp, now_ns.time_since_epoch().count()))
+      _LOG_DEBUG("State::_addTimestamp(): " << timestamp << " is too far ahead to move the clock");
+  }
 
-  _saveHistory(timestamp, eventList);
+  // a second insert would leave a count-2 IBF cell that never peels
+  if (m_content->m_NotificationHistory.contains(timestamp))
+  {
+    _LOG_DEBUG("State::_addTimestamp(): " << timestamp << " is already held");
+    return;
+  }
+  _advanceKeyBase(timestamp);
+  uint64_t key;
+  if (!StateSnapshot::_keyOf(timestamp, m_content->m_keyBase, m_options.keyResolution, key))
+  {
+    _LOG_DEBUG("State::_addTimestamp(): " << timestamp << " is before the key base");
+    return;
+  }
+  StateSnapshot& content = _mutableContent();
+  content.m_ibft.insert(key, StateSnapshot::_pseudoRandomValue(timestamp));
 
+  // before the history, which may evict this very timestamp
   if(m_stateType == StateType::TUPLE && partyIndex != 0 )
   {
-    // TBD_hila: save history for partyIndex
+    content.m_NotificationTuple[partyIndex].insert(timestamp);
+    content.m_producerOfTimestamp[timestamp] = partyIndex;
   }
 
-
+  _saveHistory(timestamp, eventList);
 }
 uint64_t
 State::createKey(const std::vector<Name>& eventList)
+{
+  uint64_t timestamp = reserveKey();
+  addLocal(timestamp, eventList);
+  return timestamp;
+}
+
+uint64_t
+State::reserveKey()
 {
   // get current timestamp in nanoseconds
   auto now_ns = boost::chrono::time_point_cast<boost::chrono::nanoseconds>(ndn::time::system_clock::now());
-  auto now_ns_long_type = (now_ns.time_since_epoch()).count();
+  uint64_t timestamp = (now_ns.time_since_epoch()).count();
 
-  _LOG_DEBUG("State::createKey(): index timestamp " << now_ns_long_type);
-  m_ibft.insert(now_ns_long_type, _pseudoRandomValue(now_ns_long_type));
+  if (m_options.keyClock == KeyClock::HYBRID)
+    timestamp = m_clock.next(timestamp);
+  else
+  {
+    // on the key grid if there is one, and not a timestamp already held
+    // or reserved (several notifications within one clock tick)
+    uint64_t step = 1;
+    if (m_options.keyResolution != 0)
+    {
+      timestamp -= timestamp % m_options.keyResolution;
+      step = m_options.keyResolution;
+    }
+    while (m_content->m_NotificationHistory.contains(timestamp) ||
+           m_reservedKeys.count(timestamp) != 0)
+      timestamp += step;
+  }
+  m_reservedKeys.insert(timestamp);
 
-  //std::cout << "Table after createKey" << m_ibft.DumpTable()<< std::endl;
-  _saveHistory(now_ns_long_type, eventList);
-  return now_ns_long_type;
+  _LOG_DEBUG("State::reserveKey(): index timestamp " << timestamp);
+  return timestamp;
 }
 void
 State::erase(const uint64_t timestamp)
 {
   _LOG_DEBUG("State::erase(): remove timestamp " << timestamp);
-  m_ibft.erase(timestamp, _pseudoRandomValue(timestamp));
+  uint64_t key;
+  if (StateSnapshot::_keyOf(timestamp, m_content->m_keyBase, m_options.keyResolution, key))
+    _mutableContent().m_ibft.erase(key, StateSnapshot::_pseudoRandomValue(timestamp));
 
   //std::cout << "Table after update" << m_ibft.DumpTable()<< std::endl;
   _removeFromHistory(timestamp);
@@ -102,114 +207,494 @@ State::isExpired(const uint64_t now, uint64_t timestamp, ndn::time::milliseconds
 ConstBufferPtr
 State::getState() const
 {
-  if(m_stateType == StateType::TUPLE )
-  {
-
-  }
-  else if(m_stateType == StateType::LIST)
-  {
-    size_t estimatedSize = 0;
-    EncodingEstimator estimator;
-    //size_t estimatedSize = wireEncode(estimator);
-    for(auto iTime: m_NotificationHistory)
-    {
-      estimatedSize += prependNonNegativeIntegerBlock(estimator, tlv::ListEntry, iTime.first);
-    }
-    estimatedSize += estimator.prependVarNumber(estimatedSize);
-    estimatedSize += estimator.prependVarNumber(tlv::ListTable);
-
-    EncodingBuffer buffer(estimatedSize);
-    estimatedSize = 0;
-    for(auto iTime: m_NotificationHistory)
-    {
-      estimatedSize += prependNonNegativeIntegerBlock(buffer, tlv::ListEntry, iTime.first);
-    }
-    estimatedSize += buffer.prependVarNumber(estimatedSize);
-    estimatedSize += buffer.prependVarNumber(tlv::ListTable);
+  if (m_encodedStateVersion == m_content->getVersion())
+    return m_encodedState;
 
+  m_encodedState = m_content->getState();
+  m_encodedStateVersion = m_content->getVersion();
+  return m_encodedState;
+}
 
-    //wireEncode(buffer);
+ConstBufferPtr
+State::getStateDigest() const
+{
+  if (m_stateDigestVersion == m_content->getVersion())
+    return m_stateDigest;
 
-    Block listBlock = buffer.block();
+  m_stateDigest = m_content->getStateDigest();
+  m_stateDigestVersion = m_content->getVersion();
+  return m_stateDigest;
+}
 
-    auto contentBuffer = bzip2::compress(reinterpret_cast<const char*>(listBlock.wire()),
-                                                                      listBlock.size());
-    return contentBuffer;
-  }
-  else if (m_stateType == StateType::IBF)
-  {
-    Block ibfBlock = m_ibft.wireEncode();
+ConstBufferPtr
+StateSnapshot::getState() const
+{
+  Block stateBlock = _encodeState();
+  return StateCodec::compress(m_options.codec, stateBlock.wire(), stateBlock.size(),
+                              m_options.dictionaryId);
+}
 
-    auto contentBuffer = bzip2::compress(reinterpret_cast<const char*>(ibfBlock.wire()),
-                                                                      ibfBlock.size());
-    return contentBuffer;
-  }
+ConstBufferPtr
+StateSnapshot::getStateDigest() const
+{
+  // over the encoding before compression, so peers using different
+  // codecs agree on it
+  Block stateBlock = _encodeState();
+  return ndn::util::Sha256::computeDigest(stateBlock.wire(), stateBlock.size());
+}
 
+Block
+StateSnapshot::_encodeState() const
+{
+  if(m_stateType == StateType::TUPLE )
+    return _encodeTuple();
+  else if(m_stateType == StateType::BLOOM)
+    return _encodeBloom();
+  else if(m_stateType == StateType::RANGE)
+    return _encodeRanges();
+  else if(m_stateType == StateType::SKETCH)
+    return m_sketch.wireEncode();
+  else if(m_stateType == StateType::LIST)
+    return _encodeList();
+  else
+    return m_ibft.wireEncode();
 }
 
 bool State::getDiff(ConstBufferPtr rmtStateStr,
                    std::set<std::pair<uint64_t,std::vector<uint8_t> > >& inLocal,
                    std::set<std::pair<uint64_t,std::vector<uint8_t> > >& inRemote) const
 {
-  auto remoteBuf = bzip2::decompress(rmtStateStr->get<char>(),
-                                     rmtStateStr->size());
+  std::shared_ptr<DecodedState> remote;
+  return _getDiff(rmtStateStr, inLocal, inRemote, remote);
+}
+
+bool State::_getDiff(ConstBufferPtr rmtStateStr,
+                     std::set<std::pair<uint64_t,std::vector<uint8_t> > >& inLocal,
+                     std::set<std::pair<uint64_t,std::vector<uint8_t> > >& inRemote,
+                     std::shared_ptr<DecodedState>& remote) const
+{
+  remote = _decodeRemoteState(rmtStateStr);
+  if (remote == nullptr)
+    return false;
+
+  // consumers in sync send the same state, the diff is done once per
+  // version of ours
+  if (remote->diffVersion != m_content->getVersion())
+  {
+    remote->inLocal.clear();
+    remote->inRemote.clear();
+    remote->diffResult = m_content->_computeDiff(*remote, remote->inLocal, remote->inRemote);
+    remote->diffVersion = m_content->getVersion();
+  }
+  inLocal.insert(remote->inLocal.begin(), remote->inLocal.end());
+  inRemote.insert(remote->inRemote.begin(), remote->inRemote.end());
+  return remote->diffResult;
+}
+
+bool StateSnapshot::getDiff(ConstBufferPtr rmtStateStr,
+                            std::set<std::pair<uint64_t,std::vector<uint8_t> > >& inLocal,
+                            std::set<std::pair<uint64_t,std::vector<uint8_t> > >& inRemote) const
+{
+  std::shared_ptr<DecodedState> remote = _decodeRemoteState(rmtStateStr);
+  if (remote == nullptr)
+    return false;
+  return _computeDiff(*remote, inLocal, inRemote);
+}
+
+bool StateSnapshot::getDiff(ConstBufferPtr rmtStateStr,
+                            std::set<std::pair<uint64_t,std::vector<uint8_t> > >& inLocal,
+                            std::set<std::pair<uint64_t,std::vector<uint8_t> > >& inRemote,
+                            Block& subRanges) const
+{
+  std::shared_ptr<DecodedState> remote = _decodeRemoteState(rmtStateStr);
+  if (remote == nullptr)
+    return false;
+  std::vector<RangeFingerprint> ranges;
+  if (!_computeDiff(*remote, inLocal, inRemote, &ranges))
+    return false;
+  subRanges = ranges.empty() ? Block() : _encodeRangeList(ranges);
+  return true;
+}
 
+bool StateSnapshot::_computeDiff(const DecodedState& remote,
+                         std::set<std::pair<uint64_t,std::vector<uint8_t> > >& inLocal,
+                         std::set<std::pair<uint64_t,std::vector<uint8_t> > >& inRemote,
+                         std::vector<RangeFingerprint>* subRanges /*= nullptr*/) const
+{
   if(m_stateType == StateType::TUPLE)
   {
+    std::vector<uint8_t> emptyVec;
+    const std::vector<std::pair<uint64_t,uint64_t>>& remoteVersions = remote.versions;
 
+    // a producer's timestamps only grow, so the peer has everything of
+    // producer p up to its version R(p): our timestamps of p above R(p)
+    // are local only, and R(p) itself is new to us if above ours
+    std::unordered_map<uint64_t,uint64_t> remoteLatest(remoteVersions.begin(),
+                                                       remoteVersions.end());
+    for (auto const& producer: m_NotificationTuple)
+    {
+      auto remoteIt = remoteLatest.find(producer.first);
+      uint64_t known = remoteIt == remoteLatest.end() ? 0 : remoteIt->second;
+      for (auto it = producer.second.upper_bound(known); it != producer.second.end(); ++it)
+        inLocal.insert(std::make_pair(*it, emptyVec));
+    }
+    for (auto const& version: remoteVersions)
+    {
+      if (version.second > _latestOfProducer(version.first))
+        inRemote.insert(std::make_pair(version.second, emptyVec));
+    }
+    return true;
   }
-  if(m_stateType == StateType::LIST)
+  else if(m_stateType == StateType::BLOOM)
   {
-    Block bufferBlock = Block(remoteBuf);
+    // the filter cannot be listed: only what the peer lacks is known,
+    // short of the false positives
     std::vector<uint8_t> emptyVec;
-    std::vector<uint64_t> decodedVec;
-    if(!bufferBlock.hasWire())
+    for (auto timestamp: m_NotificationHistory.timestamps())
     {
-      _LOG_ERROR("no wire");
-      return false;
+      if (!remote.bloom.contains(timestamp))
+        inLocal.insert(inLocal.end(), std::make_pair(timestamp, emptyVec));
     }
+    return true;
+  }
+  else if(m_stateType == StateType::RANGE)
+  {
+    // our timestamps in a range whose fingerprint differs are all
+    // local-only as far as we can tell, the peer skips those it holds;
+    // what it holds in a range we cannot list. A range with more than
+    // rangeLeafSize of ours is split instead if subRanges is given,
+    // unless the peer holds nothing in it.
+    std::vector<uint8_t> emptyVec;
+    size_t leafSize = std::max<size_t>(m_options.rangeLeafSize, 1);
+    std::vector<uint64_t> localVec = _sortedTimestamps();
+    auto it = localVec.begin();
+    for (auto const& range: remote.ranges)
+    {
+      // below a full state's ranges: older than anything the peer
+      // holds; a request lists only the ranges still to compare
+      auto first = std::upper_bound(it, localVec.end(), range.lower);
+      for (; !remote.rangeRequest && it != first; ++it)
+        inLocal.insert(inLocal.end(), std::make_pair(*it, emptyVec));
+      it = first;
+
+      uint64_t hashSum = 0;
+      for (; it != localVec.end() && *it <= range.upper; ++it)
+        hashSum += MurmurHash3Mix64(0, *it);
+      size_t count = it - first;
+      if (count == range.count && hashSum == range.hashSum)
+        continue;
 
-    if (bufferBlock.type() != tlv::ListTable)
+      if (subRanges == nullptr || count <= leafSize || range.count == 0)
+      {
+        for (auto leaf = first; leaf != it; ++leaf)
+          inLocal.insert(inLocal.end(), std::make_pair(*leaf, emptyVec));
+        continue;
+      }
+
+      // parts of about the same number of our timestamps, the last one
+      // up to the range's upper bound
+      size_t parts = std::min(RANGE_FANOUT, (count + leafSize - 1) / leafSize);
+      uint64_t lower = range.lower;
+      auto partFirst = first;
+      for (size_t part = 1; part <= parts; part++)
+      {
+        auto partEnd = first + part * count / parts;
+        RangeFingerprint sub;
+        sub.lower = lower;
+        sub.upper = part == parts ? range.upper : *(partEnd - 1);
+        sub.count = partEnd - partFirst;
+        sub.hashSum = 0;
+        for (; partFirst != partEnd; ++partFirst)
+          sub.hashSum += MurmurHash3Mix64(0, *partFirst);
+        subRanges->push_back(sub);
+        lower = sub.upper;
+      }
+    }
+    // newer than anything the peer holds
+    for (; !remote.rangeRequest && it != localVec.end(); ++it)
+      inLocal.insert(inLocal.end(), std::make_pair(*it, emptyVec));
+    return true;
+  }
+  else if(m_stateType == StateType::SKETCH)
+  {
+    // the merged sketch decodes to the symmetric difference, split by
+    // what we hold; beyond the capacity nothing is known and all our
+    // timestamps are local-only, the peer skips those it holds
+    std::vector<uint8_t> emptyVec;
+    PinSketch diff(m_sketch);
+    diff.merge(remote.sketch);
+    std::vector<uint64_t> elements;
+    if (!diff.decode(elements, diff.getCapacity() - 1))
     {
-      _LOG_ERROR("expecting tlv::ListTable");
-      return false;
+      _LOG_DEBUG("State::_computeDiff: sketch diff above capacity " << diff.getCapacity() - 1);
+      for (auto timestamp: m_NotificationHistory.timestamps())
+        inLocal.insert(inLocal.end(), std::make_pair(timestamp, emptyVec));
+      return true;
     }
-    bufferBlock.parse();
-    for (Block::element_const_iterator it = bufferBlock.elements_begin();
-         it != bufferBlock.elements_end(); it++)
+    for (auto timestamp: elements)
     {
-      if (it->type() == tlv::ListEntry)
-      {
-        uint64_t remoteTime =  readNonNegativeInteger(*it);
-        decodedVec.push_back(remoteTime);
-        //std::cout << "  *****Decoded: "<< remoteTime << std::endl;
-      }
+      if (m_NotificationHistory.contains(timestamp))
+        inLocal.insert(std::make_pair(timestamp, emptyVec));
+      else
+        inRemote.insert(std::make_pair(timestamp, emptyVec));
     }
-    // create inLocal, if local is not in decoded then add
-    for(auto i: m_NotificationHistory)
+    return true;
+  }
+  else if(m_stateType == StateType::LIST)
+  {
+    if (remote.hasWatermark)
     {
-      if ( std::find(decodedVec.begin(), decodedVec.end(), i.first) == decodedVec.end() )
-         inLocal.insert(std::make_pair(i.first, emptyVec));
+      _watermarkDiff(remote, inLocal, inRemote);
+      return true;
     }
-    // create inRemote, if decoded not in local history then add
-    for(auto i: decodedVec)
+
+    std::vector<uint8_t> emptyVec;
+    const std::vector<uint64_t>& decodedVec = remote.timestamps;
+    uint64_t remoteResolution = remote.resolution;
+
+    // merge both sorted lists: local-only timestamps go to inLocal,
+    // remote-only ones to inRemote. A quantized remote list holds
+    // timestamp/resolution, so local timestamps are compared the same
+    // way and remote-only entries come out as the start of their slot.
+    std::vector<uint64_t> localVec = _sortedTimestamps();
+    auto localIt = localVec.begin();
+    auto remoteIt = decodedVec.begin();
+    bool remoteMatched = false;
+    while (localIt != localVec.end() || remoteIt != decodedVec.end())
     {
-      auto entry = m_NotificationHistory.find(i);
-      if( entry == m_NotificationHistory.end())
-        inRemote.insert(std::make_pair(i, emptyVec));
+      uint64_t localSlot = (localIt != localVec.end()) ? *localIt / remoteResolution : 0;
+      if (remoteIt == decodedVec.end() || (localIt != localVec.end() && localSlot < *remoteIt))
+      {
+        inLocal.insert(inLocal.end(), std::make_pair(*localIt, emptyVec));
+        ++localIt;
+      }
+      else if (localIt == localVec.end() || *remoteIt < localSlot)
+      {
+        if (!remoteMatched)
+          inRemote.insert(inRemote.end(), std::make_pair(*remoteIt * remoteResolution, emptyVec));
+        remoteMatched = false;
+        ++remoteIt;
+      }
+      else
+      {
+        // several local timestamps may share one quantized slot
+        remoteMatched = true;
+        ++localIt;
+      }
     }
     return true;
   }
   else if (m_stateType == StateType::IBF)
   {
-    IBFT remoteIBF(remoteBuf, m_maxNotificationMemory, 4);
+    const IBFT& remoteIBF = *remote.ibf;
 
     // std::cout << "My IBF" << m_ibft.dumpItems() << std::endl;
     // std::cout << "Remote" << remoteIBF.dumpItems() << std::endl;
 
+    if (remoteIBF.getHashType() != m_ibft.getHashType() ||
+        remoteIBF.getKeyBase() != m_ibft.getKeyBase() ||
+        remoteIBF.getKeyResolution() != m_ibft.getKeyResolution())
+    {
+      if (!IBFT::isSupportedHashType(remoteIBF.getHashType()))
+      {
+        _LOG_ERROR("State::getDiff: unsupported remote IBF hash type " << remoteIBF.getHashType());
+        return false;
+      }
+      // peer hashes differently (e.g. an older version) or counts its
+      // keys from another base, rebuild our table its way from history
+      // so the diff stays valid
+      _LOG_DEBUG("State::getDiff: remote IBF hash type " << remoteIBF.getHashType()
+                 << " key base " << remoteIBF.getKeyBase() << ", rebuilding local table");
+      IBFT localIBF = _buildIBF(remoteIBF.getHashType(), remoteIBF.getKeyBase(),
+                                remoteIBF.getKeyResolution());
+
+      IBFT diff = localIBF-remoteIBF;
+      bool result = _listTimestamps(diff, inLocal, inRemote);
+
+      // timestamps past the end of the remote key range are ones the
+      // peer cannot hold yet (it would have moved its base)
+      std::vector<uint8_t> emptyVec;
+      if (remoteIBF.getKeyResolution() != 0)
+      {
+        uint64_t rangeEnd = remoteIBF.getKeyBase() +
+                            std::numeric_limits<uint32_t>::max() * remoteIBF.getKeyResolution();
+        for (auto timestamp: m_NotificationHistory.timestampsAfter(rangeEnd))
+          inLocal.insert(std::make_pair(timestamp, emptyVec));
+      }
+      return result;
+    }
+
     IBFT diff = m_ibft-remoteIBF;
-    return (diff.listEntries(inLocal, inRemote));
+    return _listTimestamps(diff, inLocal, inRemote);
+  }
+}
+
+bool
+StateSnapshot::_listTimestamps(const IBFT& diff,
+                               std::set<std::pair<uint64_t,std::vector<uint8_t> > >& inLocal,
+                               std::set<std::pair<uint64_t,std::vector<uint8_t> > >& inRemote)
+{
+  uint64_t resolution = diff.getKeyResolution();
+  if (resolution == 0)
+    return diff.listEntries(inLocal, inRemote);
+
+  std::set<std::pair<uint64_t,std::vector<uint8_t> > > localKeys, remoteKeys;
+  bool result = diff.listEntries(localKeys, remoteKeys);
+  for (auto const& entry: localKeys)
+    inLocal.insert(std::make_pair(diff.getKeyBase() + entry.first * resolution, entry.second));
+  for (auto const& entry: remoteKeys)
+    inRemote.insert(std::make_pair(diff.getKeyBase() + entry.first * resolution, entry.second));
+  return result;
+}
+
+uint64_t
+StateSnapshot::_keyBaseOf(uint64_t timestamp, uint64_t resolution)
+{
+  // half key ranges are 2^31 units long, so every timestamp from the
+  // base up to the end of timestamp's half range fits in 32 bits
+  uint64_t half = resolution << 31;
+  uint64_t start = timestamp / half * half;
+  return start >= half ? start - half : 0;
+}
+
+bool
+StateSnapshot::_keyOf(uint64_t timestamp, uint64_t base, uint64_t resolution,
+                      uint64_t& key)
+{
+  if (resolution == 0)
+  {
+    key = timestamp;
+    return true;
+  }
+  if (timestamp < base)
+    return false;
+  key = (timestamp - base) / resolution;
+  return key <= std::numeric_limits<uint32_t>::max();
+}
+
+IBFT
+StateSnapshot::_buildIBF(int hashType, uint64_t base, uint64_t resolution) const
+{
+  IBFT ibft(m_maxNotificationMemory, 4, hashType);
+  ibft.setKeyBase(base, resolution);
+  uint64_t key;
+  for (auto timestamp: m_NotificationHistory.timestamps())
+  {
+    if (_keyOf(timestamp, base, resolution, key))
+      ibft.insert(key, _pseudoRandomValue(timestamp));
+  }
+  return ibft;
+}
+
+std::shared_ptr<StateSnapshot::DecodedState>
+StateSnapshot::_decodeRemoteState(ConstBufferPtr rmtStateStr) const
+{
+  auto remoteBuf = StateCodec::decompress(rmtStateStr->data(), rmtStateStr->size());
+  if (remoteBuf == nullptr)
+  {
+    _LOG_ERROR("State::getDiff: unable to decompress remote state");
+    return nullptr;
+  }
+
+  auto decoded = std::make_shared<DecodedState>();
+  decoded->wire = rmtStateStr;
+  decoded->resolution = 1;
+  decoded->diffVersion = 0;
+  decoded->diffResult = false;
+  decoded->hasWatermark = false;
+  decoded->watermark = 0;
+  decoded->prefixCount = 0;
+  decoded->prefixHash = 0;
+  decoded->rangeLower = 0;
+  decoded->rangeRequest = false;
+  if(m_stateType == StateType::TUPLE)
+  {
+    if (!_decodeTuple(Block(remoteBuf), decoded->versions))
+      return nullptr;
+  }
+  else if(m_stateType == StateType::RANGE)
+  {
+    Block rangeBlock(remoteBuf);
+    decoded->rangeRequest = rangeBlock.type() == tlv::RangeList;
+    if (decoded->rangeRequest ? !_decodeRangeList(rangeBlock, decoded->ranges)
+                              : !_decodeRanges(rangeBlock, *decoded))
+      return nullptr;
+  }
+  else if(m_stateType == StateType::BLOOM)
+  {
+    if (!decoded->bloom.wireDecode(Block(remoteBuf)))
+    {
+      _LOG_ERROR("expecting tlv::BloomTable");
+      return nullptr;
+    }
+  }
+  else if(m_stateType == StateType::SKETCH)
+  {
+    // a spare power sum is needed to check the decoded diff
+    if (!decoded->sketch.wireDecode(Block(remoteBuf)) || decoded->sketch.getCapacity() < 2)
+    {
+      _LOG_ERROR("expecting tlv::SketchTable");
+      return nullptr;
+    }
+  }
+  else if(m_stateType == StateType::LIST)
+  {
+    Block bufferBlock(remoteBuf);
+    if (bufferBlock.type() == tlv::ListWatermarkTable)
+    {
+      if (!_decodeWatermarkList(bufferBlock, *decoded))
+        return nullptr;
+    }
+    else if (!_decodeList(bufferBlock, decoded->timestamps, decoded->resolution))
+      return nullptr;
+  }
+  else
+    decoded->ibf = std::make_shared<IBFT>(remoteBuf, m_maxNotificationMemory, 4);
+  return decoded;
+}
+
+std::shared_ptr<State::DecodedState>
+State::_decodeRemoteState(ConstBufferPtr rmtStateStr) const
+{
+  // the size goes into the key too, and a hit is confirmed bytewise
+  uint64_t key = (static_cast<uint64_t>(rmtStateStr->size()) << 32) |
+                 MurmurHash3(0, rmtStateStr->data(), rmtStateStr->size());
+  auto cached = m_decodedStateIndex.find(key);
+  if (cached != m_decodedStateIndex.end() && *cached->second->second->wire == *rmtStateStr)
+  {
+    m_decodedStates.splice(m_decodedStates.begin(), m_decodedStates, cached->second);
+    return cached->second->second;
   }
+
+  auto decoded = m_content->_decodeRemoteState(rmtStateStr);
+  if (decoded == nullptr || m_options.decodedStateCacheSize == 0)
+    return decoded;
+
+  // a different state with the same key is replaced
+  if (cached != m_decodedStateIndex.end())
+  {
+    m_decodedStates.erase(cached->second);
+    m_decodedStateIndex.erase(cached);
+  }
+  m_decodedStates.push_front(std::make_pair(key, decoded));
+  m_decodedStateIndex[key] = m_decodedStates.begin();
+  while (m_decodedStates.size() > m_options.decodedStateCacheSize)
+  {
+    m_decodedStateIndex.erase(m_decodedStates.back().first);
+    m_decodedStates.pop_back();
+  }
+  return decoded;
+}
+
+// A timestamp from a peer is taken if it has not expired, or if it is
+// ahead of our clock by no more than max_freshness (clock skew): one
+// further ahead would move the key base past our own notifications
+static bool
+isLiveRemote(uint64_t now, uint64_t timestamp, ndn::time::milliseconds max_freshness)
+{
+  if (timestamp > now)
+    return timestamp - now <= static_cast<uint64_t>(max_freshness.count()) * 1000000;
+  return !State::isExpired(now, timestamp, max_freshness);
 }
 
 bool
@@ -218,20 +703,72 @@ State::reconcile(ConstBufferPtr newState, NotificationData& data, ndn::time::mil
   auto now_ns = boost::chrono::time_point_cast<boost::chrono::nanoseconds>(ndn::time::system_clock::now());
   auto now_ns_long_type = (now_ns.time_since_epoch()).count();
   std::set<std::pair<uint64_t,std::vector<uint8_t> > > inNew, inOld;
+  std::shared_ptr<DecodedState> remote;
   //ConstBufferPtr oldState  = getState();
-  if (getDiff(newState, inOld, inNew))
+  if (_getDiff(newState, inOld, inNew, remote))
   {
+    if (m_stateType == StateType::TUPLE)
+    {
+      // the vector only names the latest timestamp of each producer,
+      // the pushed events carry the ones in between and their producer
+      for(auto const& pushed: data.m_eventsObj.getEventList())
+      {
+        if (m_content->m_NotificationHistory.contains(pushed.first) ||
+            !isLiveRemote(now_ns_long_type, pushed.first, max_freshness))
+          continue;
+
+        uint64_t producer = data.m_eventsObj.getProducer(pushed.first);
+        if (producer == 0)
+        {
+          _LOG_ERROR("State::reconcile: no producer index for " << pushed.first);
+          continue;
+        }
+        _addTimestamp(pushed.first, pushed.second, producer);
+      }
+      return true;
+    }
+
+    uint64_t resolution = remote->resolution;
+    if (m_stateType == StateType::BLOOM || m_stateType == StateType::RANGE ||
+        m_stateType == StateType::SKETCH || resolution > 1 || remote->hasWatermark)
+    {
+      // quantized state only tells which slots are new, a watermark
+      // state lists only the recent timestamps, Bloom filters and range
+      // fingerprints none, a sketch none beyond its capacity: the exact
+      // timestamps come with the pushed events
+      for(auto const& pushed: data.m_eventsObj.getEventList())
+      {
+        uint64_t slotStart = pushed.first / resolution * resolution;
+        if ((resolution > 1 &&
+             inNew.find(std::make_pair(slotStart, std::vector<uint8_t>())) == inNew.end()) ||
+            m_content->m_NotificationHistory.contains(pushed.first))
+          continue;
+
+        if(isLiveRemote(now_ns_long_type, pushed.first, max_freshness))
+          _addTimestamp(pushed.first, pushed.second);
+      }
+      return true;
+    }
+
     // for now, only add new timestamps to local IBF and History
     for(auto const& newit: inNew)
     {
       _LOG_DEBUG("State::reconcile: found new item: " << newit.first);
-      if(!State::isExpired(now_ns_long_type, newit.first, max_freshness))
+      if(isLiveRemote(now_ns_long_type, newit.first, max_freshness))
       {
+        // a timestamp in the producer's state whose events were not
+        // pushed (not ready yet): held, it would never be pushed again
+        auto pushed = data.m_eventsObj.getEventList().find(newit.first);
+        if (pushed == data.m_eventsObj.getEventList().end() || pushed->second.empty())
+        {
+          _LOG_DEBUG("State::reconcile: no events for " << newit.first);
+          continue;
+        }
         _LOG_DEBUG("State::reconcile: item is fresh  " << newit.first);
-        _addTimestamp(newit.first, data.m_eventsObj.getEventList(newit.first));
+        _addTimestamp(newit.first, pushed->second);
       }
       else
-        _LOG_DEBUG("State::reconcile: item expired  " << newit.first);
+        _LOG_DEBUG("State::reconcile: item expired or too far ahead " << newit.first);
 
       //listToPush[lit.first] = m_state.getEventsAtTimestamp(lit.first);
     }
@@ -250,51 +787,753 @@ State::cleanup(ndn::time::milliseconds max_freshness)
   auto now_ns = boost::chrono::time_point_cast<boost::chrono::nanoseconds>(ndn::time::system_clock::now());
   auto now_ns_long_type = (now_ns.time_since_epoch()).count();
 
-  std::set<std::pair<uint64_t,std::vector<uint8_t> > > positive;
-  std::set<std::pair<uint64_t,std::vector<uint8_t> > > negative;
+  // timestamps expire in order, so only the expired ones are looked at
+  // and the IBF does not need to be decodable. Timestamps ahead of our
+  // clock (remote skew) are not expired.
+  while (!m_content->m_NotificationHistory.empty() &&
+         m_content->m_NotificationHistory.oldest() <= static_cast<uint64_t>(now_ns_long_type) &&
+         isExpired(now_ns_long_type, m_content->m_NotificationHistory.oldest(), max_freshness))
+  {
+    erase(m_content->m_NotificationHistory.oldest());
+  }
+}
+
+ConstBufferPtr
+State::saveImage() const
+{
+  const StateSnapshot& content = *m_content;
+  StateFile::Header header;
+  header.stateType = m_stateType;
+  header.localIndex = m_localIndex;
+  header.keyBase = content.m_keyBase;
+  header.keyResolution = m_options.keyResolution;
+  header.hashType = content.m_ibft.getHashType();
+  header.cellCount = content.m_ibft.getCellCount();
 
-  if(m_ibft.listEntries(positive, negative))
+  std::vector<uint8_t> cells(content.m_ibft.getCellImageSize());
+  content.m_ibft.writeCellImage(cells.data());
+
+  // every name once, however many notifications carry it
+  std::map<Name, uint32_t> nameIndex;
+  std::vector<Name> names;
+  std::vector<StateFile::Entry> entries;
+  std::vector<uint32_t> events;
+  entries.reserve(content.m_NotificationHistory.size());
+  for (auto timestamp: content.m_NotificationHistory.timestamps())
   {
-    std::set<std::pair<uint64_t,std::vector<uint8_t> > > :: iterator it; //iterator to manipulate set
-    for (it = positive.begin(); it!=positive.end(); it++)
+    NotificationHistory::EventListView view = content.m_NotificationHistory.view(timestamp);
+    StateFile::Entry entry;
+    entry.timestamp = timestamp;
+    entry.producer = content.getProducer(timestamp);
+    entry.firstEvent = events.size();
+    entry.eventCount = view.size();
+    for (size_t i = 0; i < view.size(); i++)
     {
-        std::pair<uint64_t,std::vector<uint8_t> > m = *it; // returns pair to m
-        if(isExpired(now_ns_long_type, m.first, max_freshness))
-        {
+      auto inserted = nameIndex.emplace(view[i], names.size());
+      if (inserted.second)
+        names.push_back(view[i]);
+      events.push_back(inserted.first->second);
+    }
+    entries.push_back(entry);
+  }
+  return StateFile::build(header, cells.data(), cells.size(), entries, events, names);
+}
 
-          // remove from state
-          erase(m.first);
-        }
+size_t
+State::restore(const std::string& path, ndn::time::milliseconds maxFreshness)
+{
+  if (!m_content->m_NotificationHistory.empty())
+  {
+    _LOG_ERROR("State::restore: the state is not new");
+    return 0;
+  }
+  StateFile file;
+  if (!file.open(path))
+    return 0;
+  const StateFile::Header& header = file.getHeader();
+  if (header.stateType != static_cast<uint32_t>(m_stateType))
+  {
+    _LOG_ERROR("State::restore: " << path << " holds state type " << header.stateType);
+    return 0;
+  }
+
+  // a TUPLE producer keeps its index, so its saved notifications stay
+  // its latest ones
+  if (m_stateType == StateType::TUPLE && header.localIndex != 0)
+    m_localIndex = header.localIndex;
+
+  auto now_ns = boost::chrono::time_point_cast<boost::chrono::nanoseconds>(ndn::time::system_clock::now());
+  uint64_t now_ns_long_type = (now_ns.time_since_epoch()).count();
+
+  // the saved cells are used as they are if the table is ours, the
+  // expired notifications are then erased from them; otherwise the IBF
+  // is built again from the notifications
+  StateSnapshot& content = _mutableContent();
+  bool cellsRestored = header.hashType == static_cast<uint32_t>(content.m_ibft.getHashType()) &&
+                       header.keyResolution == m_options.keyResolution &&
+                       content.m_ibft.readCellImage(file.getCells(), header.cellCount,
+                                                    header.cellBytes);
+  if (cellsRestored)
+  {
+    content.m_keyBase = header.keyBase;
+    content.m_ibft.setKeyBase(header.keyBase, m_options.keyResolution);
+  }
+
+  size_t restored = 0;
+  std::vector<Name> eventList;
+  for (size_t i = 0; i < header.entryCount; i++)
+  {
+    StateFile::Entry entry = file.getEntry(i);
+    bool expired = entry.timestamp <= now_ns_long_type &&
+                   isExpired(now_ns_long_type, entry.timestamp, maxFreshness);
+    if (expired)
+    {
+      uint64_t key;
+      if (cellsRestored &&
+          StateSnapshot::_keyOf(entry.timestamp, m_content->m_keyBase, m_options.keyResolution, key))
+        _mutableContent().m_ibft.erase(key, StateSnapshot::_pseudoRandomValue(entry.timestamp));
+      continue;
     }
-    for (it = negative.begin(); it!=negative.end(); it++)
+
+    file.getEvents(entry, eventList);
+    if (!cellsRestored)
+      _addTimestamp(entry.timestamp, eventList, entry.producer);
+    else
     {
-        std::pair<uint64_t,std::vector<uint8_t> > m = *it; // returns pair to m
-        if(isExpired(now_ns_long_type, m.first, max_freshness))
-        {
-          // remove from state
-          erase(m.first);
-        }
+      if (m_options.keyClock == KeyClock::HYBRID)
+        m_clock.observe(entry.timestamp, now_ns_long_type);
+      if (m_stateType == StateType::TUPLE && entry.producer != 0)
+      {
+        StateSnapshot& tupleContent = _mutableContent();
+        tupleContent.m_NotificationTuple[entry.producer].insert(entry.timestamp);
+        tupleContent.m_producerOfTimestamp[entry.timestamp] = entry.producer;
+      }
+      _saveHistory(entry.timestamp, eventList);
     }
+    restored++;
   }
+  _LOG_INFO("State::restore: " << restored << " notifications from " << path
+            << (cellsRestored ? "" : ", IBF rebuilt"));
+  return restored;
 }
 
-std::vector<Name>&
-State::getEventsAtTimestamp(uint64_t timestamp)
+void
+State::addLocal(uint64_t timestamp, const std::vector<Name>& eventList)
 {
-  std::vector<Name> emptyVec;
-  auto entry = m_NotificationHistory.find(timestamp);
-  if(entry != m_NotificationHistory.end())
-    return entry->second;
-  else
-    return emptyVec;
+  m_reservedKeys.erase(timestamp);
+  // ours under TUPLE
+  _addTimestamp(timestamp, eventList, m_stateType == StateType::TUPLE ? m_localIndex : 0);
+}
+
+Block
+StateSnapshot::_encodeList() const
+{
+  // entries go on the wire in ascending order, so equal sets encode
+  // identically and diffs can merge
+  if (m_options.listEncoding == ListEncoding::WATERMARK)
+    return _encodeWatermarkList();
+
+  std::vector<uint64_t> timestamps = _sortedTimestamps();
+
+  if (m_options.listEncoding == ListEncoding::DELTA)
+  {
+    // resolution, count, first slot, then the gaps between slots
+    uint64_t resolution = m_options.listResolution;
+    std::vector<uint8_t> value;
+    value.reserve(timestamps.size() * 4 + 16);
+    appendVarint(value, resolution);
+    appendVarint(value, timestamps.size());
+    uint64_t previous = 0;
+    for(auto iTime: timestamps)
+    {
+      uint64_t slot = iTime / resolution;
+      appendVarint(value, slot - previous);
+      previous = slot;
+    }
+
+    EncodingBuffer buffer(value.size() + 10);
+    buffer.prependByteArrayBlock(tlv::ListDeltaTable, value.data(), value.size());
+    return buffer.block();
+  }
+
+  // with keyResolution the entries are offsets from the key base,
+  // which every live timestamp is at or above
+  uint64_t keyResolution = m_options.keyResolution;
+  if (keyResolution != 0)
+  {
+    for (auto& iTime: timestamps)
+      iTime = (iTime - m_keyBase) / keyResolution;
+  }
+
+  size_t estimatedSize = 0;
+  EncodingEstimator estimator;
+  for(auto iTime = timestamps.rbegin(); iTime != timestamps.rend(); ++iTime)
+  {
+    estimatedSize += prependNonNegativeIntegerBlock(estimator, tlv::ListEntry, *iTime);
+  }
+  if (keyResolution != 0)
+  {
+    estimatedSize += prependNonNegativeIntegerBlock(estimator, tlv::KeyResolution, keyResolution);
+    estimatedSize += prependNonNegativeIntegerBlock(estimator, tlv::KeyBase, m_keyBase);
+  }
+  estimatedSize += estimator.prependVarNumber(estimatedSize);
+  estimatedSize += estimator.prependVarNumber(tlv::ListTable);
+
+  EncodingBuffer buffer(estimatedSize);
+  estimatedSize = 0;
+  for(auto iTime = timestamps.rbegin(); iTime != timestamps.rend(); ++iTime)
+  {
+    estimatedSize += prependNonNegativeIntegerBlock(buffer, tlv::ListEntry, *iTime);
+  }
+  if (keyResolution != 0)
+  {
+    estimatedSize += prependNonNegativeIntegerBlock(buffer, tlv::KeyResolution, keyResolution);
+    estimatedSize += prependNonNegativeIntegerBlock(buffer, tlv::KeyBase, m_keyBase);
+  }
+  estimatedSize += buffer.prependVarNumber(estimatedSize);
+  estimatedSize += buffer.prependVarNumber(tlv::ListTable);
+
+  return buffer.block();
+}
+
+bool
+StateSnapshot::_decodeList(const Block& bufferBlock, std::vector<uint64_t>& timestamps,
+                   uint64_t& resolution)
+{
+  resolution = 1;
+  if(!bufferBlock.hasWire())
+  {
+    _LOG_ERROR("no wire");
+    return false;
+  }
+
+  if (bufferBlock.type() == tlv::ListDeltaTable)
+  {
+    const uint8_t* pos = bufferBlock.value();
+    const uint8_t* end = pos + bufferBlock.value_size();
+    uint64_t count = 0;
+    if (!readVarint(pos, end, resolution) || resolution == 0 || !readVarint(pos, end, count))
+    {
+      _LOG_ERROR("malformed tlv::ListDeltaTable header");
+      return false;
+    }
+    // every gap takes at least one byte
+    timestamps.reserve(std::min<uint64_t>(count, end - pos));
+    uint64_t slot = 0;
+    for (uint64_t i = 0; i < count; ++i)
+    {
+      uint64_t gap;
+      if (!readVarint(pos, end, gap))
+      {
+        _LOG_ERROR("truncated tlv::ListDeltaTable");
+        return false;
+      }
+      // a zero gap is another notification in the same slot
+      slot += gap;
+      if (i == 0 || gap != 0)
+        timestamps.push_back(slot);
+    }
+    return true;
+  }
+
+  if (bufferBlock.type() != tlv::ListTable)
+  {
+    _LOG_ERROR("expecting tlv::ListTable");
+    return false;
+  }
+  bufferBlock.parse();
+  timestamps.reserve(bufferBlock.elements().size());
+  uint64_t keyBase = 0;
+  uint64_t keyResolution = 0;
+  for (Block::element_const_iterator it = bufferBlock.elements_begin();
+       it != bufferBlock.elements_end(); it++)
+  {
+    if (it->type() == tlv::ListEntry)
+    {
+      timestamps.push_back(readNonNegativeInteger(*it));
+    }
+    else if (it->type() == tlv::KeyBase)
+      keyBase = readNonNegativeInteger(*it);
+    else if (it->type() == tlv::KeyResolution)
+      keyResolution = readNonNegativeInteger(*it);
+  }
+  if (keyResolution != 0)
+  {
+    for (auto& timestamp: timestamps)
+      timestamp = keyBase + timestamp * keyResolution;
+  }
+  // peers running older versions send the list unordered
+  if (!std::is_sorted(timestamps.begin(), timestamps.end()))
+    std::sort(timestamps.begin(), timestamps.end());
+  return true;
+}
+
+Block
+StateSnapshot::_encodeWatermarkList() const
+{
+  // only the timestamps after the watermark are looked at: the summary
+  // of the ones up to it is what is left of the running totals
+  uint64_t watermark = 0;
+  if (!m_NotificationHistory.empty() &&
+      m_NotificationHistory.newest() > m_options.listWatermarkWindow)
+    watermark = m_NotificationHistory.newest() - m_options.listWatermarkWindow;
+  std::vector<uint64_t> suffix = m_NotificationHistory.timestampsAfter(watermark);
+
+  uint64_t prefixHash = m_timestampHashSum;
+  for (auto timestamp: suffix)
+    prefixHash -= MurmurHash3Mix64(0, timestamp);
+
+  // watermark, prefix count and hash sum, count, then gaps from the
+  // watermark
+  std::vector<uint8_t> value;
+  value.reserve(suffix.size() * 4 + 32);
+  appendVarint(value, watermark);
+  appendVarint(value, m_NotificationHistory.size() - suffix.size());
+  appendVarint(value, prefixHash);
+  appendVarint(value, suffix.size());
+  uint64_t previous = watermark;
+  for (auto timestamp: suffix)
+  {
+    appendVarint(value, timestamp - previous);
+    previous = timestamp;
+  }
+
+  EncodingBuffer buffer(value.size() + 10);
+  buffer.prependByteArrayBlock(tlv::ListWatermarkTable, value.data(), value.size());
+  return buffer.block();
+}
+
+bool
+StateSnapshot::_decodeWatermarkList(const Block& bufferBlock, DecodedState& decoded)
+{
+  const uint8_t* pos = bufferBlock.value();
+  const uint8_t* end = pos + bufferBlock.value_size();
+  uint64_t count = 0;
+  if (!readVarint(pos, end, decoded.watermark) || !readVarint(pos, end, decoded.prefixCount) ||
+      !readVarint(pos, end, decoded.prefixHash) || !readVarint(pos, end, count))
+  {
+    _LOG_ERROR("malformed tlv::ListWatermarkTable header");
+    return false;
+  }
+  decoded.hasWatermark = true;
+  decoded.timestamps.reserve(std::min<uint64_t>(count, end - pos));
+  uint64_t timestamp = decoded.watermark;
+  for (uint64_t i = 0; i < count; ++i)
+  {
+    uint64_t gap;
+    if (!readVarint(pos, end, gap) || gap == 0)
+    {
+      _LOG_ERROR("malformed tlv::ListWatermarkTable");
+      return false;
+    }
+    timestamp += gap;
+    decoded.timestamps.push_back(timestamp);
+  }
+  return true;
+}
+
+void
+StateSnapshot::_watermarkDiff(const DecodedState& remote,
+                      std::set<std::pair<uint64_t,std::vector<uint8_t> > >& inLocal,
+                      std::set<std::pair<uint64_t,std::vector<uint8_t> > >& inRemote) const
+{
+  std::vector<uint8_t> emptyVec;
+  std::vector<uint64_t> localSuffix = m_NotificationHistory.timestampsAfter(remote.watermark);
+
+  // the peer is assumed to hold what we hold up to its watermark; if
+  // the summaries disagree (a gap on either side, or entries expired
+  // on one side only) everything we hold up to it goes out again
+  uint64_t prefixHash = m_timestampHashSum;
+  for (auto timestamp: localSuffix)
+    prefixHash -= MurmurHash3Mix64(0, timestamp);
+  if (m_NotificationHistory.size() - localSuffix.size() != remote.prefixCount ||
+      prefixHash != remote.prefixHash)
+  {
+    _LOG_DEBUG("State::getDiff: summary below watermark " << remote.watermark << " differs");
+    m_NotificationHistory.forEachUpTo(remote.watermark, [&] (uint64_t timestamp) {
+      inLocal.insert(inLocal.end(), std::make_pair(timestamp, emptyVec));
+    });
+  }
+
+  // both suffixes are sorted
+  auto localIt = localSuffix.begin();
+  auto remoteIt = remote.timestamps.begin();
+  while (localIt != localSuffix.end() || remoteIt != remote.timestamps.end())
+  {
+    if (remoteIt == remote.timestamps.end() ||
+        (localIt != localSuffix.end() && *localIt < *remoteIt))
+      inLocal.insert(inLocal.end(), std::make_pair(*localIt++, emptyVec));
+    else if (localIt == localSuffix.end() || *remoteIt < *localIt)
+      inRemote.insert(inRemote.end(), std::make_pair(*remoteIt++, emptyVec));
+    else
+    {
+      ++localIt;
+      ++remoteIt;
+    }
+  }
+}
+
+std::vector<uint64_t>
+StateSnapshot::_sortedTimestamps() const
+{
+  return m_NotificationHistory.timestamps();
+}
+
+Block
+StateSnapshot::_encodeTuple() const
+{
+  // sorted by producer index, so equal vectors encode identically
+  std::vector<std::pair<uint64_t,uint64_t>> versions;
+  versions.reserve(m_NotificationTuple.size());
+  for (auto const& producer: m_NotificationTuple)
+    versions.push_back(std::make_pair(producer.first, *producer.second.rbegin()));
+  std::sort(versions.begin(), versions.end());
+
+  // count, then (producer index, latest timestamp) pairs
+  std::vector<uint8_t> value;
+  value.reserve(versions.size() * 14 + 4);
+  appendVarint(value, versions.size());
+  for (auto const& version: versions)
+  {
+    appendVarint(value, version.first);
+    appendVarint(value, version.second);
+  }
+
+  EncodingBuffer buffer(value.size() + 10);
+  buffer.prependByteArrayBlock(tlv::TupleTable, value.data(), value.size());
+  return buffer.block();
+}
+
+bool
+StateSnapshot::_decodeTuple(const Block& bufferBlock,
+                    std::vector<std::pair<uint64_t,uint64_t>>& versions)
+{
+  if(!bufferBlock.hasWire())
+  {
+    _LOG_ERROR("no wire");
+    return false;
+  }
+  if (bufferBlock.type() != tlv::TupleTable)
+  {
+    _LOG_ERROR("expecting tlv::TupleTable");
+    return false;
+  }
+
+  const uint8_t* pos = bufferBlock.value();
+  const uint8_t* end = pos + bufferBlock.value_size();
+  uint64_t count = 0;
+  if (!readVarint(pos, end, count))
+  {
+    _LOG_ERROR("malformed tlv::TupleTable header");
+    return false;
+  }
+  // every pair takes at least two bytes
+  versions.reserve(std::min<uint64_t>(count, (end - pos) / 2));
+  for (uint64_t i = 0; i < count; ++i)
+  {
+    uint64_t producer, latest;
+    if (!readVarint(pos, end, producer) || !readVarint(pos, end, latest))
+    {
+      _LOG_ERROR("truncated tlv::TupleTable");
+      return false;
+    }
+    versions.push_back(std::make_pair(producer, latest));
+  }
+  return true;
+}
+
+Block
+StateSnapshot::_encodeBloom() const
+{
+  // sized for what we hold now, the filter grows and shrinks with it
+  BloomFilter filter(m_NotificationHistory.size(), m_options.bloomFalsePositiveRate);
+  for (auto timestamp: m_NotificationHistory.timestamps())
+    filter.insert(timestamp);
+  return filter.wireEncode();
+}
+
+Block
+StateSnapshot::_encodeRanges() const
+{
+  std::vector<uint64_t> timestamps = _sortedTimestamps();
+
+  // range ends (exclusive indexes), newest first: leaf, leaf, then
+  // twice the previous size, so a peer that is slightly behind
+  // mismatches on small ranges only
+  std::vector<size_t> ends;
+  size_t end = timestamps.size();
+  size_t size = std::max<size_t>(m_options.rangeLeafSize, 1);
+  for (int i = 0; end > 0; i++)
+  {
+    ends.push_back(end);
+    end -= std::min(end, size);
+    if (i > 0)
+      size *= 2;
+  }
+  std::reverse(ends.begin(), ends.end());
+
+  // oldest timestamp, count, then per range the gap from the previous
+  // bound to its upper bound, its count and hash sum
+  std::vector<uint8_t> value;
+  value.reserve(ends.size() * 16 + 16);
+  uint64_t previous = timestamps.empty() ? 0 : timestamps.front();
+  appendVarint(value, previous);
+  appendVarint(value, ends.size());
+  size_t start = 0;
+  for (auto rangeEnd: ends)
+  {
+    uint64_t hashSum = 0;
+    for (size_t i = start; i < rangeEnd; i++)
+      hashSum += MurmurHash3Mix64(0, timestamps[i]);
+    appendVarint(value, timestamps[rangeEnd - 1] - previous);
+    appendVarint(value, rangeEnd - start);
+    appendVarint(value, hashSum);
+    previous = timestamps[rangeEnd - 1];
+    start = rangeEnd;
+  }
+
+  EncodingBuffer buffer(value.size() + 10);
+  buffer.prependByteArrayBlock(tlv::RangeTable, value.data(), value.size());
+  return buffer.block();
+}
+
+bool
+StateSnapshot::_decodeRanges(const Block& bufferBlock, DecodedState& decoded)
+{
+  if(!bufferBlock.hasWire() || bufferBlock.type() != tlv::RangeTable)
+  {
+    _LOG_ERROR("expecting tlv::RangeTable");
+    return false;
+  }
+
+  const uint8_t* pos = bufferBlock.value();
+  const uint8_t* end = pos + bufferBlock.value_size();
+  uint64_t count = 0;
+  if (!readVarint(pos, end, decoded.rangeLower) || !readVarint(pos, end, count))
+  {
+    _LOG_ERROR("malformed tlv::RangeTable header");
+    return false;
+  }
+  // every range takes at least three bytes
+  decoded.ranges.reserve(std::min<uint64_t>(count, (end - pos) / 3));
+  uint64_t previous = decoded.rangeLower;
+  for (uint64_t i = 0; i < count; ++i)
+  {
+    uint64_t gap;
+    RangeFingerprint range;
+    if (!readVarint(pos, end, gap) || !readVarint(pos, end, range.count) ||
+        !readVarint(pos, end, range.hashSum))
+    {
+      _LOG_ERROR("truncated tlv::RangeTable");
+      return false;
+    }
+    // the first range starts at the oldest timestamp, timestamps are
+    // never 0
+    range.lower = i == 0 ? previous - 1 : previous;
+    range.upper = previous + gap;
+    previous = range.upper;
+    decoded.ranges.push_back(range);
+  }
+  return true;
+}
+
+Block
+StateSnapshot::_encodeRangeList(const std::vector<RangeFingerprint>& ranges)
+{
+  // count, then per range the gap from the previous upper bound to its
+  // lower bound, the gap to its upper bound, its count and hash sum
+  std::vector<uint8_t> value;
+  value.reserve(ranges.size() * 20 + 10);
+  appendVarint(value, ranges.size());
+  uint64_t previous = 0;
+  for (auto const& range: ranges)
+  {
+    appendVarint(value, range.lower - previous);
+    appendVarint(value, range.upper - range.lower);
+    appendVarint(value, range.count);
+    appendVarint(value, range.hashSum);
+    previous = range.upper;
+  }
+
+  EncodingBuffer buffer(value.size() + 10);
+  buffer.prependByteArrayBlock(tlv::RangeList, value.data(), value.size());
+  return buffer.block();
+}
+
+bool
+StateSnapshot::_decodeRangeList(const Block& bufferBlock, std::vector<RangeFingerprint>& ranges)
+{
+  if(!bufferBlock.hasWire() || bufferBlock.type() != tlv::RangeList)
+  {
+    _LOG_ERROR("expecting tlv::RangeList");
+    return false;
+  }
+
+  const uint8_t* pos = bufferBlock.value();
+  const uint8_t* end = pos + bufferBlock.value_size();
+  uint64_t count = 0;
+  if (!readVarint(pos, end, count))
+  {
+    _LOG_ERROR("malformed tlv::RangeList header");
+    return false;
+  }
+  // every range takes at least four bytes
+  ranges.reserve(std::min<uint64_t>(count, (end - pos) / 4));
+  uint64_t previous = 0;
+  for (uint64_t i = 0; i < count; ++i)
+  {
+    uint64_t lowerGap, upperGap;
+    RangeFingerprint range;
+    if (!readVarint(pos, end, lowerGap) || !readVarint(pos, end, upperGap) ||
+        !readVarint(pos, end, range.count) || !readVarint(pos, end, range.hashSum))
+    {
+      _LOG_ERROR("truncated tlv::RangeList");
+      return false;
+    }
+    range.lower = previous + lowerGap;
+    range.upper = range.lower + upperGap;
+    previous = range.upper;
+    ranges.push_back(range);
+  }
+  return true;
+}
+
+ConstBufferPtr
+StateSnapshot::getRangeRequest(const Block& rangeList) const
+{
+  std::vector<RangeFingerprint> ranges;
+  if (m_stateType != StateType::RANGE || !_decodeRangeList(rangeList, ranges))
+    return nullptr;
+
+  std::vector<uint64_t> timestamps = _sortedTimestamps();
+  std::vector<RangeFingerprint> differing;
+  auto it = timestamps.begin();
+  for (auto const& range: ranges)
+  {
+    RangeFingerprint ours = range;
+    ours.count = 0;
+    ours.hashSum = 0;
+    for (it = std::upper_bound(it, timestamps.end(), range.lower);
+         it != timestamps.end() && *it <= range.upper; ++it)
+    {
+      ours.count++;
+      ours.hashSum += MurmurHash3Mix64(0, *it);
+    }
+    if (ours.count != range.count || ours.hashSum != range.hashSum)
+      differing.push_back(ours);
+  }
+  if (differing.empty())
+    return nullptr;
+
+  Block request = _encodeRangeList(differing);
+  return StateCodec::compress(m_options.codec, request.wire(), request.size(),
+                              m_options.dictionaryId);
+}
+
+uint64_t
+StateSnapshot::_latestOfProducer(uint64_t producer) const
+{
+  auto it = m_NotificationTuple.find(producer);
+  return it == m_NotificationTuple.end() ? 0 : *it->second.rbegin();
+}
+
+uint64_t
+StateSnapshot::getProducer(uint64_t timestamp) const
+{
+  auto it = m_producerOfTimestamp.find(timestamp);
+  return it == m_producerOfTimestamp.end() ? 0 : it->second;
+}
+
+std::vector<Name>
+StateSnapshot::getEventsAtTimestamp(uint64_t timestamp) const
+{
+  return m_NotificationHistory.find(timestamp);
+}
+NotificationHistory::EventListView
+StateSnapshot::getEventsViewAtTimestamp(uint64_t timestamp) const
+{
+  return m_NotificationHistory.view(timestamp);
+}
+
+template<encoding::Tag T>
+size_t
+StateSnapshot::_prependEvents(EncodingImpl<T>& encoder, const std::vector<uint64_t>& timestamps,
+                              const Block& subRanges) const
+{
+  size_t listLength = NotificationData::NotificationEventsList::prependRanges(encoder, subRanges);
+  for (auto it = timestamps.rbegin(); it != timestamps.rend(); ++it)
+    listLength += NotificationData::NotificationEventsList::prependEventEntry(encoder, *it, getProducer(*it),
+                                                                              m_NotificationHistory.view(*it));
+  listLength += encoder.prependVarNumber(listLength);
+  listLength += encoder.prependVarNumber(tlv::NotificationList);
+
+  return NotificationData::prependReply(encoder, NotificationData::dataType::EventsContainer, listLength);
 }
+
+Block
+StateSnapshot::encodeEvents(const std::vector<uint64_t>& timestamps,
+                            const Block& subRanges /*= Block()*/) const
+{
+  EncodingEstimator estimator;
+  size_t estimatedSize = _prependEvents(estimator, timestamps, subRanges);
+
+  EncodingBuffer buffer(estimatedSize);
+  _prependEvents(buffer, timestamps, subRanges);
+  return buffer.block();
+}
+
+uint64_t
+State::getProducer(uint64_t timestamp) const
+{
+  return m_content->getProducer(timestamp);
+}
+
+std::vector<Name>
+State::getEventsAtTimestamp(uint64_t timestamp) const
+{
+  return m_content->getEventsAtTimestamp(timestamp);
+}
+
+NotificationHistory::EventListView
+State::getEventsViewAtTimestamp(uint64_t timestamp) const
+{
+  return m_content->getEventsViewAtTimestamp(timestamp);
+}
+
+Block
+State::encodeEvents(const std::vector<uint64_t>& timestamps) const
+{
+  return m_content->encodeEvents(timestamps);
+}
+
+ConstBufferPtr
+State::getRangeRequest(const Block& ranges) const
+{
+  return m_content->getRangeRequest(ranges);
+}
+
 void
 State::_removeFromHistory(uint64_t timestamp)
 {
   _LOG_DEBUG("State::_removeFromHistory");
 
-  m_NotificationHistory.erase(timestamp);
+  StateSnapshot& content = _mutableContent();
+  if (content.m_NotificationHistory.erase(timestamp))
+  {
+    content.m_timestampHashSum -= MurmurHash3Mix64(0, timestamp);
+    content.m_sketch.add(timestamp);
+  }
+  content.m_version++;
 
+  auto producer = content.m_producerOfTimestamp.find(timestamp);
+  if (producer != content.m_producerOfTimestamp.end())
+  {
+    auto tuple = content.m_NotificationTuple.find(producer->second);
+    tuple->second.erase(timestamp);
+    if (tuple->second.empty())
+      content.m_NotificationTuple.erase(tuple);
+    content.m_producerOfTimestamp.erase(producer);
+  }
 }
 
 void
@@ -302,20 +1541,61 @@ State::_saveHistory(uint64_t timestamp, const std::vector<Name>&eventList)
 {
   _LOG_DEBUG("State::_saveHistory");
 
-  m_NotificationHistory[timestamp] = eventList;
+  StateSnapshot& content = _mutableContent();
+  if (!content.m_NotificationHistory.contains(timestamp))
+  {
+    content.m_timestampHashSum += MurmurHash3Mix64(0, timestamp);
+    content.m_sketch.add(timestamp);
+  }
+  content.m_NotificationHistory.insert(timestamp, eventList);
+  content.m_version++;
+  _enforceMemoryBudget();
+}
+void
+State::_enforceMemoryBudget()
+{
+  if (m_options.maxMemoryBytes == 0)
+    return;
+
+  // the newest notification always stays, even if it alone is too big
+  while (m_content->m_NotificationHistory.bytesUsed() > m_options.maxMemoryBytes &&
+         m_content->m_NotificationHistory.size() > 1)
+  {
+    _LOG_DEBUG("State::_enforceMemoryBudget: evict " << m_content->m_NotificationHistory.oldest());
+    erase(m_content->m_NotificationHistory.oldest());
+    m_evictionCount++;
+  }
+}
 
-  // auto entry = m_NotificationTuple.find(timestamp);
-  // if(entry != m_NotificationHistory.end())
-  //   return entry->second;
-  // else
-  //   return emptyVec;
-  // notificationList_t TimestampsForIndex = m_NotificationTuple[m_localIndex];
-  // TimestampsForIndex
+void
+State::_advanceKeyBase(uint64_t timestamp)
+{
+  if (m_options.keyResolution == 0)
+    return;
+  uint64_t base = StateSnapshot::_keyBaseOf(timestamp, m_options.keyResolution);
+  if (base <= m_content->m_keyBase)
+    return;
+
+  // what is left below the new base is at least half a key range older
+  // than timestamp, so long expired if memoryFreshness fits in it
+  while (!m_content->m_NotificationHistory.empty() &&
+         m_content->m_NotificationHistory.oldest() < base)
+    erase(m_content->m_NotificationHistory.oldest());
 
+  _LOG_DEBUG("State::_advanceKeyBase(): key base " << base);
+  StateSnapshot& content = _mutableContent();
+  content.m_keyBase = base;
+  content.m_ibft = content._buildIBF(m_options.hashType, base, m_options.keyResolution);
+  content.m_version++;
 }
+
 std::string State::dumpHistory() const
 {
-  return dumpHistory(m_NotificationHistory);
+  const NotificationHistory& history = m_content->m_NotificationHistory;
+  std::unordered_map<uint64_t,std::vector<Name>> items;
+  for(auto timestamp: history.timestamps())
+    items[timestamp] = history.find(timestamp);
+  return dumpHistory(items);
 }
 
 std::string State::dumpHistory(std::unordered_map<uint64_t,std::vector<Name>> history) const
@@ -339,7 +1619,7 @@ std::string State::dumpItems() const
   std::set<std::pair<uint64_t,std::vector<uint8_t> > > positive;
   std::set<std::pair<uint64_t,std::vector<uint8_t> > > negative;
 
-  result << "can be resolved:" << m_ibft.listEntries(positive, negative) << "\n";
+  result << "can be resolved:" << m_content->m_ibft.listEntries(positive, negative) << "\n";
   std::set<std::pair<uint64_t,std::vector<uint8_t> > > :: iterator it; //iterator to manipulate set
   for (it = positive.begin(); it!=positive.end(); it++){
       std::pair<uint64_t,std::vector<uint8_t> > m = *it; // returns pair to m
@@ -349,11 +1629,12 @@ std::string State::dumpItems() const
 }
 
 std::vector<uint8_t>
-State::_pseudoRandomValue(uint64_t n)
+StateSnapshot::_pseudoRandomValue(uint64_t n)
 {
-    std::vector<uint8_t> result;
+    // byte i is the hash of the i bytes before it
+    std::vector<uint8_t> result(8);
     for (int i = 0; i < 8; i++) {
-        result.push_back(static_cast<uint8_t>(MurmurHash3(n+i, result) & 0xff));
+        result[i] = static_cast<uint8_t>(MurmurHash3(n+i, result.data(), i) & 0xff);
     }
     return result;
 }
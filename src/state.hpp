@@ -21,16 +21,13 @@
 #include "common.hpp"
 #include "ibft.hpp"
 #include "notificationData.hpp"
-#include <sstream>
-#include <boost/iostreams/filtering_streambuf.hpp>
-#include <boost/iostreams/copy.hpp>
-#include <boost/iostreams/filter/gzip.hpp>
+#include "state-codec.hpp"
+#include "notification-history.hpp"
+#include "hybrid-clock.hpp"
+#include "bloom-filter.hpp"
+#include "pin-sketch.hpp"
 
-#include <boost/iostreams/detail/iostream.hpp>
-#include <boost/iostreams/filter/bzip2.hpp>
-#include <boost/iostreams/copy.hpp>
-
-#include <ndn-cxx/encoding/buffer-stream.hpp>
+#include <list>
 
 namespace notificationLib {
 
@@ -42,18 +39,355 @@ namespace StateType
   {
     IBF = 1,
     LIST = 2,
-    TUPLE = 3
+    TUPLE = 3,
+    BLOOM = 4,
+    RANGE = 5,
+    SKETCH = 6
   };
 }
+
+// Wire format of a LIST state
+namespace ListEncoding
+{
+  enum
+  {
+    TLV = 1,      // one ListEntry TLV per timestamp (understood by all peers)
+    DELTA = 2,    // first timestamp then varint gaps, in one ListDeltaTable
+    WATERMARK = 3 // a summary of the timestamps up to a watermark, then
+                  // the ones after it as gaps, in one ListWatermarkTable
+  };
+}
+
+// What notification interests carry as their last name component
+namespace InterestState
+{
+  enum
+  {
+    FULL = 1,  // the compressed state (understood by all peers)
+    DIGEST = 2 // its SHA-256, the state itself only when asked for
+  };
+}
+
+// How createKey picks the timestamp of a new notification
+namespace KeyClock
+{
+  enum
+  {
+    WALL = 1,  // the system clock in ns, the next free ns if taken
+    HYBRID = 2 // a hybrid logical clock (see HybridClock)
+  };
+}
+
+/**
+ * Optional per-notification state settings, read from the
+ * notification section of the configuration file.
+ */
+struct StateOptions
+{
+  StateOptions()
+    : hashType(HashType::MURMUR3)
+    , listEncoding(ListEncoding::TLV)
+    , listResolution(1)
+    , codec(CodecType::BZIP2)
+    , dictionaryId(0)
+    , maxMemoryBytes(0)
+    , interestState(InterestState::FULL)
+    , decodedStateCacheSize(16)
+    , listWatermarkWindow(1000000000)
+    , keyResolution(0)
+    , keyClock(KeyClock::WALL)
+    , keyNode(-1)
+    , keyMaxDrift(1000000000)
+    , bloomFalsePositiveRate(0.01)
+    , rangeLeafSize(8)
+    , sketchCapacity(16)
+    , snapshotInterval(10000)
+    , walSyncInterval(5)
+    , walBatchSize(64)
+  {
+  }
+
+  // IBF hash scheme (HashType::*)
+  int hashType;
+  // LIST wire format (ListEncoding::*)
+  int listEncoding;
+  // DELTA only: timestamps are sent as timestamp/listResolution (in ns).
+  // Values above 1 shrink the state further, but notifications that
+  // fall in the same slot are no longer told apart by the diff.
+  uint64_t listResolution;
+  // compression of the encoded state (CodecType::*)
+  int codec;
+  // ZSTD_DICT only: id of a dictionary loaded into StateCodec
+  uint32_t dictionaryId;
+  // byte budget of the notification history, oldest notifications are
+  // evicted beyond it (0: bounded by freshness only)
+  size_t maxMemoryBytes;
+  // InterestState::*, the same for every peer of the notification
+  int interestState;
+  // remote states kept decoded for the next diff against them (0: none)
+  size_t decodedStateCacheSize;
+  // WATERMARK only: timestamps within this many ns of our newest one are
+  // listed, older ones are only summarized
+  uint64_t listWatermarkWindow;
+  // IBF and LIST (TLV) only: when not 0, timestamps are created on a grid
+  // of this many ns and sent as 32-bit offsets from a base that follows
+  // the newest timestamp (0: absolute 64-bit timestamps)
+  uint64_t keyResolution;
+  // KeyClock::*, HYBRID needs keyResolution 0
+  int keyClock;
+  // HYBRID only: node id of this producer, below 2^HybridClock::NODE_BITS
+  // and different for every producer of the notification; -1 draws one
+  // at random, which two producers may both draw
+  int keyNode;
+  // HYBRID only: timestamps more than this many ns ahead of the system
+  // clock do not move the clock
+  uint64_t keyMaxDrift;
+  // BLOOM only: chance that a notification the peer lacks is taken as
+  // held and not pushed to it
+  double bloomFalsePositiveRate;
+  // RANGE only: timestamps in the two newest ranges, each older range
+  // holds twice as many as the one after it
+  size_t rangeLeafSize;
+  // SKETCH only: notifications the diff against a peer can tell apart,
+  // 8 bytes of state each; a larger diff pushes everything we hold
+  size_t sketchCapacity;
+  // when set, the state is restored from this file on startup and saved
+  // to it every snapshotInterval ms (see StateFile)
+  std::string snapshotFile;
+  uint64_t snapshotInterval;
+  // when set, the notifications we make are logged to segment files in
+  // this directory before they are pushed (see NotificationLog), and
+  // replayed on startup. A batch is synced after walSyncInterval ms or
+  // once it holds walBatchSize notifications.
+  std::string walDirectory;
+  uint64_t walSyncInterval;
+  size_t walBatchSize;
+};
+
+class State;
+
+/**
+ * The notifications of a State at one version: IBF, history index and
+ * TUPLE vectors. A State hands its content out as a snapshot and copies
+ * it before the next change while a snapshot is still held, so a
+ * snapshot never changes and its const methods may be called from any
+ * thread (encoding, compression and diffs off the io thread).
+ */
+class StateSnapshot
+{
+public:
+  StateSnapshot(size_t maxNotificationMemory, int stateType, const StateOptions& options);
+
+  // changes whenever a notification is added or removed
+  uint64_t
+  getVersion() const
+  {
+    return m_version;
+  }
+
+  // compressed state, as sent in notification interests
+  ConstBufferPtr getState() const;
+
+  ConstBufferPtr getStateDigest() const;
+
+  // as State::getDiff, without its cache of decoded remote states
+  bool getDiff(ConstBufferPtr rmtStateStr,
+               std::set<std::pair<uint64_t,std::vector<uint8_t> > >& inLocal,
+               std::set<std::pair<uint64_t,std::vector<uint8_t> > >& inRemote) const;
+
+  // RANGE: the same, but a differing range with more than rangeLeafSize
+  // of our timestamps is not listed: it is split, and our fingerprints
+  // of its parts go in subRanges (a RangeList, no wire if none) for the
+  // peer to compare in its next round
+  bool getDiff(ConstBufferPtr rmtStateStr,
+               std::set<std::pair<uint64_t,std::vector<uint8_t> > >& inLocal,
+               std::set<std::pair<uint64_t,std::vector<uint8_t> > >& inRemote,
+               Block& subRanges) const;
+
+  // RANGE: our fingerprints of the ranges in a producer's RangeList
+  // whose fingerprint differs from ours, compressed like a state to be
+  // sent in its place; nullptr if they all match
+  ConstBufferPtr getRangeRequest(const Block& ranges) const;
+
+  std::vector<Name> getEventsAtTimestamp(uint64_t timestamp) const;
+
+  // valid as long as the snapshot is
+  NotificationHistory::EventListView getEventsViewAtTimestamp(uint64_t timestamp) const;
+
+  // subRanges, if it has wire, go along (see getDiff)
+  Block encodeEvents(const std::vector<uint64_t>& timestamps,
+                     const Block& subRanges = Block()) const;
+
+  uint64_t getProducer(uint64_t timestamp) const;
+
+  size_t
+  getBytesUsed() const
+  {
+    return m_NotificationHistory.bytesUsed();
+  }
+
+private:
+  // the content is changed by its State only, while it is not shared
+  friend class State;
+
+  static std::vector<uint8_t> _pseudoRandomValue(uint64_t n);
+
+  // the key base a state whose newest timestamp is timestamp uses: the
+  // start of the half key range before the one timestamp falls in
+  static uint64_t _keyBaseOf(uint64_t timestamp, uint64_t resolution);
+
+  // IBF key of timestamp relative to base (the timestamp itself if
+  // resolution is 0); false if it does not fit in 32 bits
+  static bool _keyOf(uint64_t timestamp, uint64_t base, uint64_t resolution,
+                     uint64_t& key);
+
+  // an IBF of the history, with the given hash type and key base
+  IBFT _buildIBF(int hashType, uint64_t base, uint64_t resolution) const;
+
+  // the entries of an IBF diff, as timestamps
+  static bool _listTimestamps(const IBFT& diff,
+                              std::set<std::pair<uint64_t,std::vector<uint8_t> > >& inLocal,
+                              std::set<std::pair<uint64_t,std::vector<uint8_t> > >& inRemote);
+
+  // RANGE: a differing range with more of our timestamps than
+  // rangeLeafSize is split in this many parts at most
+  static const size_t RANGE_FANOUT = 16;
+
+  // RANGE: the timestamps above lower up to upper, by number and sum of
+  // hashes
+  struct RangeFingerprint
+  {
+    uint64_t lower;
+    uint64_t upper;
+    uint64_t count;
+    uint64_t hashSum;
+  };
+
+  // a remote state after decompression and decoding, only the fields
+  // of our state type are set
+  struct DecodedState
+  {
+    ConstBufferPtr wire;
+    std::shared_ptr<IBFT> ibf;
+    std::vector<uint64_t> timestamps;
+    uint64_t resolution;
+    std::vector<std::pair<uint64_t,uint64_t>> versions;
+    BloomFilter bloom;
+    // RANGE: oldest timestamp, then ranges in ascending order; for a
+    // request (a RangeList) only the ranges still to compare
+    uint64_t rangeLower;
+    std::vector<RangeFingerprint> ranges;
+    bool rangeRequest;
+    PinSketch sketch;
+    // WATERMARK: timestamps holds the ones above watermark only, the
+    // others are summarized by their count and hash sum
+    bool hasWatermark;
+    uint64_t watermark;
+    uint64_t prefixCount;
+    uint64_t prefixHash;
+
+    // the diff against our state at diffVersion (0: not computed)
+    uint64_t diffVersion;
+    bool diffResult;
+    std::set<std::pair<uint64_t,std::vector<uint8_t> > > inLocal;
+    std::set<std::pair<uint64_t,std::vector<uint8_t> > > inRemote;
+  };
+
+  // nullptr if rmtStateStr does not decode
+  std::shared_ptr<DecodedState> _decodeRemoteState(ConstBufferPtr rmtStateStr) const;
+
+  // subRanges: see getDiff, RANGE ranges are listed whole without it
+  bool _computeDiff(const DecodedState& remote,
+                    std::set<std::pair<uint64_t,std::vector<uint8_t> > >& inLocal,
+                    std::set<std::pair<uint64_t,std::vector<uint8_t> > >& inRemote,
+                    std::vector<RangeFingerprint>* subRanges = nullptr) const;
+
+  // the state before compression
+  Block _encodeState() const;
+
+  Block _encodeList() const;
+
+  // accepts both ListTable and ListDeltaTable, returns sorted slots
+  static bool _decodeList(const Block& block, std::vector<uint64_t>& timestamps,
+                          uint64_t& resolution);
+
+  Block _encodeWatermarkList() const;
+
+  static bool _decodeWatermarkList(const Block& block, DecodedState& decoded);
+
+  // LIST diff against a WATERMARK state
+  void _watermarkDiff(const DecodedState& remote,
+                      std::set<std::pair<uint64_t,std::vector<uint8_t> > >& inLocal,
+                      std::set<std::pair<uint64_t,std::vector<uint8_t> > >& inRemote) const;
+
+  // live timestamps in ascending order
+  std::vector<uint64_t> _sortedTimestamps() const;
+
+  template<encoding::Tag T>
+  size_t _prependEvents(EncodingImpl<T>& encoder, const std::vector<uint64_t>& timestamps,
+                        const Block& subRanges) const;
+
+  // TUPLE: the latest live timestamp of every producer, by index
+  Block _encodeTuple() const;
+
+  static bool _decodeTuple(const Block& block,
+                           std::vector<std::pair<uint64_t,uint64_t>>& versions);
+
+  // 0 if producer has no live timestamp
+  uint64_t _latestOfProducer(uint64_t producer) const;
+
+  // BLOOM: a filter of the live timestamps
+  Block _encodeBloom() const;
+
+  // RANGE: fingerprints of ranges that double in size back from the
+  // newest timestamp
+  Block _encodeRanges() const;
+
+  static bool _decodeRanges(const Block& block, DecodedState& decoded);
+
+  // RANGE: ranges that need not be adjacent, as a RangeList
+  static Block _encodeRangeList(const std::vector<RangeFingerprint>& ranges);
+
+  static bool _decodeRangeList(const Block& block, std::vector<RangeFingerprint>& ranges);
+
+  size_t m_maxNotificationMemory;
+  StateOptions m_options;
+  int m_stateType;
+  // history containers
+  IBFT m_ibft;
+  // ordered by timestamp, so also the expiry order
+  NotificationHistory m_NotificationHistory;
+  uint64_t m_version;
+  // sum of the hashes of all live timestamps, for WATERMARK summaries
+  uint64_t m_timestampHashSum;
+  // SKETCH: of the live timestamps, kept up to date as they come and go
+  PinSketch m_sketch;
+  // keyResolution only: IBF keys and LIST entries are relative to it
+  uint64_t m_keyBase;
+  // TUPLE: live timestamps per producer index, and the reverse
+  std::unordered_map<uint64_t,std::set<uint64_t>> m_NotificationTuple;
+  std::unordered_map<uint64_t,uint64_t> m_producerOfTimestamp;
+};
+
 class State : noncopyable
 {
 public:
-  State(size_t maxNotificationMemory, int listType);
+  State(size_t maxNotificationMemory, int listType,
+        const StateOptions& options = StateOptions());
 
   uint64_t createKey(const std::vector<Name>& eventList);
 
+  // createKey in two steps, for a notification that is only added once
+  // it is logged: a timestamp no other reserveKey or createKey returns,
+  // then addLocal
+  uint64_t reserveKey();
+
   ConstBufferPtr getState() const;
 
+  // SHA-256 of the state, sent in interests instead of the state when
+  // interestState is DIGEST
+  ConstBufferPtr getStateDigest() const;
+
   bool getDiff(ConstBufferPtr rmtStateStr,
                std::set<std::pair<uint64_t,std::vector<uint8_t> > >& inLocal,
                std::set<std::pair<uint64_t,std::vector<uint8_t> > >& inRemote) const;
@@ -74,7 +408,66 @@ public:
                  NotificationData& data,
                  ndn::time::milliseconds max_freshness);
 
-  std::vector<Name>& getEventsAtTimestamp(uint64_t timestamp);
+  // empty if timestamp is not in the history
+  std::vector<Name> getEventsAtTimestamp(uint64_t timestamp) const;
+
+  // the same without copying the names; valid until the state changes
+  NotificationHistory::EventListView getEventsViewAtTimestamp(uint64_t timestamp) const;
+
+  // NotificationData (EventsContainer) holding the events of
+  // timestamps, encoded straight from the history
+  Block encodeEvents(const std::vector<uint64_t>& timestamps) const;
+
+  // RANGE: see StateSnapshot::getRangeRequest
+  ConstBufferPtr getRangeRequest(const Block& ranges) const;
+
+  // bytes held by the notification history
+  size_t
+  getBytesUsed() const
+  {
+    return m_content->getBytesUsed();
+  }
+
+  // TUPLE only: index of the producer timestamp belongs to, 0 if
+  // unknown (or not a TUPLE state)
+  uint64_t getProducer(uint64_t timestamp) const;
+
+  // changes whenever a notification is added or removed
+  uint64_t
+  getVersion() const
+  {
+    return m_content->getVersion();
+  }
+
+  // The current content. Taken on the thread that changes the state,
+  // then usable from any thread; the next change copies the content
+  // first if the snapshot is still held.
+  std::shared_ptr<const StateSnapshot>
+  snapshot() const
+  {
+    return m_content;
+  }
+
+  // A StateFile image of the state, for StateFile::write (which may
+  // run on another thread)
+  ConstBufferPtr saveImage() const;
+
+  // Loads a StateFile into this state, which must be new: notifications
+  // older than maxFreshness are dropped, the IBF cells are taken as
+  // saved if the table has our settings. Returns the number of
+  // notifications restored, 0 if there is no usable file.
+  size_t restore(const std::string& path, ndn::time::milliseconds maxFreshness);
+
+  // A notification of ours: from reserveKey, or made before a restart
+  // (from the NotificationLog); nothing if it is already held.
+  void addLocal(uint64_t timestamp, const std::vector<Name>& eventList);
+
+  // notifications dropped to stay within maxMemoryBytes
+  uint64_t
+  getEvictionCount() const
+  {
+    return m_evictionCount;
+  }
 
   // for debugging
   std::string dumpItems() const;
@@ -83,86 +476,54 @@ public:
   std::string dumpHistory(std::unordered_map<uint64_t,std::vector<Name>> history) const;
 
 private:
-  std::vector<uint8_t> _pseudoRandomValue(uint64_t n);
+  typedef StateSnapshot::DecodedState DecodedState;
 
-  void _addTimestamp(uint64_t timestamp, const std::vector<Name>& eventList, int partyIndex = 0);
+  // the content, copied first if a snapshot of it is held
+  StateSnapshot& _mutableContent();
+
+  void _addTimestamp(uint64_t timestamp, const std::vector<Name>& eventList,
+                     uint64_t partyIndex = 0);
   void _saveHistory(uint64_t timestamp, const std::vector<Name>&eventList);
 
   void _removeFromHistory(uint64_t timestamp);
 
-  size_t m_maxNotificationMemory;
-  // history containers
-  IBFT m_ibft;
-  //bool m_isList;
-  int m_stateType;
-  int m_localIndex;
-  //std::unordered_map<uint64_t,shared_ptr<Data>> m_DataList;
-  notificationList_t m_NotificationHistory;
-  std::unordered_map<uint64_t,notificationList_t> m_NotificationTuple;
-  //std::vector<std::unordered_map<<uint64_t,std::vector<Name>>> m_NotificationTuple;
-};
+  // evicts the oldest notifications while over maxMemoryBytes
+  void _enforceMemoryBudget();
 
-// class Gzip {
-// public:
-// 	static std::string compress(const std::string& data)
-// 	{
-// 		namespace bio = boost::iostreams;
-//
-// 		std::stringstream compressed;
-// 		std::stringstream origin(data);
-//
-// 		bio::filtering_streambuf<bio::input> out;
-// 		out.push(bio::gzip_compressor(bio::gzip_params(bio::gzip::best_compression)));
-// 		out.push(origin);
-// 		bio::copy(out, compressed);
-//
-// 		return compressed.str();
-// 	}
-//
-// 	static std::string decompress(const std::string& data)
-// 	{
-// 		namespace bio = boost::iostreams;
-//
-// 		std::stringstream compressed(data);
-// 		std::stringstream decompressed;
-//
-// 		bio::filtering_streambuf<bio::input> out;
-// 		out.push(bio::gzip_decompressor());
-// 		out.push(compressed);
-// 		bio::copy(out, decompressed);
-//
-// 		return decompressed.str();
-// 	}
-// };
-class bzip2 {
+  // keyResolution only: moves the key base forward if timestamp lies
+  // past the key range, dropping what falls out of it
+  void _advanceKeyBase(uint64_t timestamp);
 
-public:
-  static std::shared_ptr<ndn::Buffer>
-  compress(const char* buffer, size_t bufferSize)
-  {
-    namespace bio = boost::iostreams;
-
-    ndn::OBufferStream os;
-    bio::filtering_streambuf<bio::output> out;
-    out.push(bio::bzip2_compressor());
-    out.push(os);
-    bio::stream<bio::array_source> in(reinterpret_cast<const char*>(buffer), bufferSize);
-    bio::copy(in, out);
-    return os.buf();
-  }
+  // peers in sync send the same state, so decoded states are looked up
+  // in an LRU cache first; nullptr if rmtStateStr does not decode
+  std::shared_ptr<DecodedState> _decodeRemoteState(ConstBufferPtr rmtStateStr) const;
 
-  static std::shared_ptr<ndn::Buffer>
-  decompress(const char* buffer, size_t bufferSize)
-  {
-    namespace bio = boost::iostreams;
-    ndn::OBufferStream os;
-    bio::filtering_streambuf<bio::output> out;
-    out.push(bio::bzip2_decompressor());
-    out.push(os);
-    bio::stream<bio::array_source> in(reinterpret_cast<const char*>(buffer), bufferSize);
-    bio::copy(in, out);
-    return os.buf();
-  }
+  bool _getDiff(ConstBufferPtr rmtStateStr,
+                std::set<std::pair<uint64_t,std::vector<uint8_t> > >& inLocal,
+                std::set<std::pair<uint64_t,std::vector<uint8_t> > >& inRemote,
+                std::shared_ptr<DecodedState>& remote) const;
+
+  StateOptions m_options;
+  int m_stateType;
+  // TUPLE: our producer index, random and non-zero
+  uint64_t m_localIndex;
+  // HYBRID: the key generator, with a random node id
+  HybridClock m_clock;
+  // from reserveKey, not added yet
+  std::set<uint64_t> m_reservedKeys;
+  std::shared_ptr<StateSnapshot> m_content;
+  uint64_t m_evictionCount;
+  // getState() and getStateDigest() of a version, built on first use
+  mutable ConstBufferPtr m_encodedState;
+  mutable uint64_t m_encodedStateVersion;
+  mutable ConstBufferPtr m_stateDigest;
+  mutable uint64_t m_stateDigestVersion;
+
+  // decoded remote states, most recently used first, and by hash of
+  // their wire (decodedStateCacheSize at most)
+  typedef std::list<std::pair<uint64_t,std::shared_ptr<DecodedState>>> DecodedStateList;
+  mutable DecodedStateList m_decodedStates;
+  mutable std::unordered_map<uint64_t,DecodedStateList::iterator> m_decodedStateIndex;
 };
 
 } // namespace notificationLib